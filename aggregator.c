@@ -0,0 +1,226 @@
+#include <string.h>
+#include <math.h>
+
+#include "aggregator.h"
+
+#define MSECONDS_PER_HOUR 3600000.0
+
+static inline void stats_clear(Sdm220Stats *stats)
+{
+    memset(stats, 0, SDM220_VALUE_TABLE_SIZE * sizeof(Sdm220Stats));
+}
+
+static inline void stats_add(Sdm220Stats *stats, double value)
+{
+    if (stats->count == 0u) {
+        stats->min = value;
+        stats->max = value;
+    } else {
+        if (value < stats->min)
+            stats->min = value;
+
+        if (value > stats->max)
+            stats->max = value;
+    }
+
+    stats->sum += value;
+    stats->sum_sq += value * value;
+    stats->count++;
+}
+
+static inline void stats_merge(Sdm220Stats *stats, const Sdm220Stats *other)
+{
+    if (other->count == 0u)
+        return;
+
+    if (stats->count == 0u) {
+        *stats = *other;
+        return;
+    }
+
+    if (other->min < stats->min)
+        stats->min = other->min;
+
+    if (other->max > stats->max)
+        stats->max = other->max;
+
+    stats->sum += other->sum;
+    stats->sum_sq += other->sum_sq;
+    stats->count += other->count;
+}
+
+static inline mseconds_t align(mseconds_t timestamp, mseconds_t length)
+{
+    if (length == 0u)
+        return timestamp;
+
+    return timestamp - (timestamp % length);
+}
+
+static void notify(Sdm220Aggregator *self, Sdm220AggregateKind kind, mseconds_t start,
+                   mseconds_t end, Sdm220Stats *stats, double energy)
+{
+    size_t i = 0u;
+    Sdm220Aggregate aggregate;
+
+    if (self->callback == NULL || stats[0].count == 0u)
+        return;
+
+    memset(&aggregate, 0, sizeof(aggregate));
+
+    aggregate.kind = kind;
+    aggregate.slave_address = self->meter->slave_address;
+    aggregate.start = start;
+    aggregate.end = end;
+    aggregate.count = stats[0].count;
+    aggregate.energy = energy;
+
+    for (; i < SDM220_VALUE_TABLE_SIZE; ++i) {
+        aggregate.min[i] = stats[i].min;
+        aggregate.max[i] = stats[i].max;
+        aggregate.mean[i] = stats[i].sum / (double) stats[i].count;
+        aggregate.rms[i] = sqrt(stats[i].sum_sq / (double) stats[i].count);
+    }
+
+    self->callback(self->meter, &aggregate, self->user_data);
+}
+
+static void emit_tumbling(Sdm220Aggregator *self, mseconds_t end)
+{
+    notify(self, SDM220_AGGREGATE_TUMBLING, self->tumbling_start, end,
+           self->tumbling, self->tumbling_energy);
+
+    stats_clear(self->tumbling);
+    self->tumbling_energy = 0.0;
+}
+
+static void emit_sliding(Sdm220Aggregator *self)
+{
+    size_t i = 0u;
+    size_t j = 0u;
+    double energy = 0.0;
+    mseconds_t end = 0u;
+    Sdm220Stats stats[SDM220_VALUE_TABLE_SIZE];
+
+    stats_clear(stats);
+
+    for (; i < SDM220_AGGREGATOR_N_SLOTS; ++i) {
+        for (j = 0u; j < SDM220_VALUE_TABLE_SIZE; ++j)
+            stats_merge(&stats[j], &self->slots[i][j]);
+
+        energy += self->slot_energy[i];
+    }
+
+    end = self->slot_start + self->slot_length;
+    notify(self, SDM220_AGGREGATE_SLIDING, end > self->slide ? end - self->slide : 0u,
+           end, stats, energy);
+}
+
+static void advance_tumbling(Sdm220Aggregator *self, mseconds_t timestamp)
+{
+    if (self->window == 0u || timestamp < self->tumbling_start + self->window)
+        return;
+
+    emit_tumbling(self, self->tumbling_start + self->window);
+    self->tumbling_start = align(timestamp, self->window);
+}
+
+static void advance_sliding(Sdm220Aggregator *self, mseconds_t timestamp)
+{
+    mseconds_t i = 0u;
+    mseconds_t steps = 0u;
+
+    if (self->slide == 0u || timestamp < self->slot_start + self->slot_length)
+        return;
+
+    emit_sliding(self);
+
+    steps = (timestamp - self->slot_start) / self->slot_length;
+    for (; i < steps && i < SDM220_AGGREGATOR_N_SLOTS; ++i) {
+        self->slot = (self->slot + 1u) % SDM220_AGGREGATOR_N_SLOTS;
+
+        stats_clear(self->slots[self->slot]);
+        self->slot_energy[self->slot] = 0.0;
+    }
+
+    self->slot_start += steps * self->slot_length;
+}
+
+void sdm220_aggregator_init(Sdm220Aggregator *self, mseconds_t window, mseconds_t slide,
+                            Sdm220AggregateCallback callback, void *user_data)
+{
+    memset(self, 0, sizeof(Sdm220Aggregator));
+
+    self->window = window;
+    self->slide = slide;
+    self->slot_length = slide / SDM220_AGGREGATOR_N_SLOTS;
+
+    if (self->slide != 0u && self->slot_length == 0u)
+        self->slot_length = 1u;
+
+    self->started = false;
+    self->meter = NULL;
+    self->callback = callback;
+    self->user_data = user_data;
+}
+
+void sdm220_aggregator_push(Sdm220Aggregator *self, Sdm220Meter *meter, mseconds_t timestamp)
+{
+    size_t i = 0u;
+    double power = 0.0;
+    double energy = 0.0;
+    mseconds_t max_gap = 0u;
+    mseconds_t elapsed = 0u;
+
+    power = sdm220_meter_get_active_power(meter);
+
+    if (!self->started) {
+        self->tumbling_start = align(timestamp, self->window);
+        self->slot_start = align(timestamp, self->slot_length);
+        self->last_timestamp = timestamp;
+        self->last_power = power;
+        self->started = true;
+    }
+
+    if (timestamp < self->last_timestamp)
+        /*
+         * NOTE: Wall clock stepped back, drop the sample rather than
+         * corrupt both windows.
+         */
+        return;
+
+    self->meter = meter;
+
+    advance_tumbling(self, timestamp);
+    advance_sliding(self, timestamp);
+
+    /*
+     * Trapezoidal integration of active power. Gaps longer than a whole
+     * window are not bridged: there is nothing honest to interpolate.
+     */
+    max_gap = self->window > self->slide ? self->window : self->slide;
+    elapsed = timestamp - self->last_timestamp;
+
+    if (elapsed != 0u && (max_gap == 0u || elapsed <= max_gap))
+        energy = (self->last_power + power) / 2.0 * (double) elapsed / MSECONDS_PER_HOUR;
+
+    for (; i < SDM220_VALUE_TABLE_SIZE; ++i) {
+        stats_add(&self->tumbling[i], meter->value_table[i]);
+        stats_add(&self->slots[self->slot][i], meter->value_table[i]);
+    }
+
+    self->tumbling_energy += energy;
+    self->slot_energy[self->slot] += energy;
+
+    self->last_timestamp = timestamp;
+    self->last_power = power;
+}
+
+void sdm220_aggregator_flush(Sdm220Aggregator *self)
+{
+    if (!self->started || self->meter == NULL)
+        return;
+
+    if (self->window != 0u)
+        emit_tumbling(self, self->last_timestamp);
+}
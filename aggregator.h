@@ -0,0 +1,112 @@
+/**
+ * @file aggregator.h
+ * @author Sereda Anton <sereda-anton@yandex.ru>
+ *
+ * Copyright (c) 2017 Sereda Anton
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+#ifndef AGGREGATOR_H
+#define AGGREGATOR_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "timer.h"
+#include "sdm220.h"
+
+/*
+ * Number of sub-buckets a sliding window is split into. Sliding aggregates
+ * are emitted once per bucket (window / SDM220_AGGREGATOR_N_SLOTS).
+ */
+#define SDM220_AGGREGATOR_N_SLOTS 12
+
+typedef struct _Sdm220Stats Sdm220Stats;
+typedef struct _Sdm220Aggregate Sdm220Aggregate;
+typedef struct _Sdm220Aggregator Sdm220Aggregator;
+typedef enum _Sdm220AggregateKind Sdm220AggregateKind;
+
+typedef void (*Sdm220AggregateCallback)(Sdm220Meter *, Sdm220Aggregate *, void *);
+
+enum _Sdm220AggregateKind {
+    SDM220_AGGREGATE_TUMBLING = 1,
+    SDM220_AGGREGATE_SLIDING
+};
+
+struct _Sdm220Stats {
+    double min;
+    double max;
+    double sum;
+    double sum_sq;
+    unsigned long count;
+};
+
+struct _Sdm220Aggregate {
+    Sdm220AggregateKind kind;
+    uint8_t slave_address;
+    mseconds_t start;
+    mseconds_t end;
+    unsigned long count;
+    double min[SDM220_VALUE_TABLE_SIZE];
+    double max[SDM220_VALUE_TABLE_SIZE];
+    double mean[SDM220_VALUE_TABLE_SIZE];
+    double rms[SDM220_VALUE_TABLE_SIZE];
+    double energy; /* Wh, integrated from active power */
+};
+
+struct _Sdm220Aggregator {
+    mseconds_t window;
+    mseconds_t slide;
+    mseconds_t slot_length;
+
+    /*
+     * Tumbling window: plain running statistics, reset on every boundary.
+     */
+    mseconds_t tumbling_start;
+    Sdm220Stats tumbling[SDM220_VALUE_TABLE_SIZE];
+    double tumbling_energy;
+
+    /*
+     * Sliding window: ring of sub-buckets. A sample only touches the current
+     * bucket, the ring is folded once per bucket when the aggregate is emitted.
+     */
+    mseconds_t slot_start;
+    size_t slot;
+    Sdm220Stats slots[SDM220_AGGREGATOR_N_SLOTS][SDM220_VALUE_TABLE_SIZE];
+    double slot_energy[SDM220_AGGREGATOR_N_SLOTS];
+
+    mseconds_t last_timestamp;
+    double last_power;
+    bool started;
+
+    Sdm220Meter *meter;
+    Sdm220AggregateCallback callback;
+    void *user_data;
+};
+
+void sdm220_aggregator_init(Sdm220Aggregator *self, mseconds_t window, mseconds_t slide,
+                            Sdm220AggregateCallback callback, void *user_data);
+
+void sdm220_aggregator_push(Sdm220Aggregator *self, Sdm220Meter *meter, mseconds_t timestamp);
+void sdm220_aggregator_flush(Sdm220Aggregator *self);
+
+#endif /* AGGREGATOR_H */
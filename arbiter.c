@@ -0,0 +1,491 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "arbiter.h"
+
+#define ARBITER_BACKLOG 8
+
+static void send_line(Arbiter *self, int client, const char *line, size_t size);
+
+bool arbiter_init(Arbiter *self, const char *path)
+{
+    size_t i = 0u;
+    struct sockaddr_un address;
+
+    memset(self, 0, sizeof(Arbiter));
+    self->fd = -1;
+
+    for (; i < ARBITER_MAX_CLIENTS; ++i)
+        self->clients[i].fd = -1;
+
+    if (strlen(path) >= sizeof(address.sun_path))
+        return false;
+
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    strcpy(address.sun_path, path);
+    strcpy(self->path, path);
+
+    self->fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (self->fd < 0) {
+        perror("socket");
+        return false;
+    }
+
+    /*
+     * A socket left behind by a previous run would make bind() fail.
+     */
+    unlink(path);
+
+    if (bind(self->fd, (struct sockaddr *) &address, sizeof(address)) != 0
+        || listen(self->fd, ARBITER_BACKLOG) != 0) {
+        perror(path);
+        close(self->fd);
+        self->fd = -1;
+        return false;
+    }
+
+    return true;
+}
+
+static void client_close(Arbiter *self, int client)
+{
+    size_t i = 0u;
+
+    close(self->clients[client].fd);
+    self->clients[client].fd = -1;
+    self->clients[client].line_size = 0u;
+
+    for (; i < ARBITER_MAX_REQUESTS; ++i) {
+        if (self->requests[i].used && self->requests[i].client == client)
+            self->requests[i].used = false;
+    }
+}
+
+void arbiter_destroy(Arbiter *self)
+{
+    int i = 0;
+
+    for (; i < ARBITER_MAX_CLIENTS; ++i) {
+        if (self->clients[i].fd >= 0)
+            client_close(self, i);
+    }
+
+    if (self->fd >= 0) {
+        close(self->fd);
+        unlink(self->path);
+    }
+
+    self->fd = -1;
+}
+
+void arbiter_add_meter(Arbiter *self, Sdm220Meter *meter)
+{
+    if (meter->slave_address <= ARBITER_MAX_ADDRESS)
+        self->meters[meter->slave_address] = meter;
+}
+
+void arbiter_set_fleet(Arbiter *self, Sdm220Fleet *fleet)
+{
+    self->fleet = fleet;
+}
+
+size_t arbiter_get_pollfds(Arbiter *self, struct pollfd *fds, size_t max_fds)
+{
+    size_t i = 0u;
+    size_t n_fds = 0u;
+
+    if (self->fd < 0 || max_fds == 0u)
+        return 0u;
+
+    fds[n_fds].fd = self->fd;
+    fds[n_fds++].events = POLLIN;
+
+    for (; i < ARBITER_MAX_CLIENTS && n_fds < max_fds; ++i) {
+        if (self->clients[i].fd < 0)
+            continue;
+
+        fds[n_fds].fd = self->clients[i].fd;
+        fds[n_fds++].events = POLLIN;
+    }
+
+    return n_fds;
+}
+
+static bool request_satisfied(ArbiterRequest *request, mseconds_t now)
+{
+    int reg = 0;
+    mseconds_t read_time = 0u;
+
+    for (; reg < SDM220_N_REGISTERS; ++reg) {
+        if ((request->mask & SDM220_REGISTER_MASK(reg)) == 0u)
+            continue;
+
+        read_time = sdm220_meter_get_read_time(request->meter, reg);
+
+        /*
+         * Read since it was asked for, or young enough anyway.
+         */
+        if (read_time == 0u
+            || (read_time < request->submitted && now - read_time > request->max_age))
+            return false;
+    }
+
+    return true;
+}
+
+static void reply_values(Arbiter *self, int client, unsigned long id, Sdm220Meter *meter,
+                         Sdm220RegisterMask mask)
+{
+    int reg = 0;
+    size_t size = 0u;
+    mseconds_t oldest = 0u;
+    mseconds_t timestamp = 0u;
+    char reply[ARBITER_REPLY_SIZE];
+
+    for (; reg < SDM220_N_REGISTERS; ++reg) {
+        timestamp = sdm220_meter_get_timestamp(meter, reg);
+
+        if ((mask & SDM220_REGISTER_MASK(reg)) != 0u && (oldest == 0u || timestamp < oldest))
+            oldest = timestamp;
+    }
+
+    size = (size_t) snprintf(reply, sizeof(reply), "ok %lu %u %lu", id,
+                             (unsigned) meter->slave_address, oldest);
+
+    for (reg = 0; reg < SDM220_N_REGISTERS && size < sizeof(reply); ++reg) {
+        if ((mask & SDM220_REGISTER_MASK(reg)) != 0u)
+            size += (size_t) snprintf(reply + size, sizeof(reply) - size, " %d=%.9g", reg,
+                                      sdm220_meter_get_value(meter, reg));
+    }
+
+    if (size < sizeof(reply))
+        size += (size_t) snprintf(reply + size, sizeof(reply) - size, "\n");
+
+    send_line(self, client, reply, size < sizeof(reply) ? size : sizeof(reply));
+}
+
+static void reply_error(Arbiter *self, int client, unsigned long id, const char *reason)
+{
+    char reply[ARBITER_LINE_SIZE];
+    int size = snprintf(reply, sizeof(reply), "error %lu %s\n", id, reason);
+
+    send_line(self, client, reply, (size_t) size);
+}
+
+static void reply_stats(Arbiter *self, int client)
+{
+    char reply[ARBITER_LINE_SIZE];
+    int size = snprintf(reply, sizeof(reply), "stats requests=%lu cache_hits=%lu merged=%lu "
+                        "queued=%lu\n", self->n_requests, self->cache_hits, self->merged,
+                        self->queued);
+
+    send_line(self, client, reply, (size_t) size);
+}
+
+static void handle_total(Arbiter *self, int client, unsigned long id, int reg)
+{
+    char reply[ARBITER_LINE_SIZE];
+    int size = 0;
+
+    if (self->fleet == NULL || reg < 0 || reg >= SDM220_N_REGISTERS) {
+        reply_error(self, client, id, "bad-register");
+        return;
+    }
+
+    size = snprintf(reply, sizeof(reply), "total %lu %d %.9g\n", id, reg,
+                    sdm220_fleet_sum(self->fleet, (Sdm220Register) reg));
+
+    send_line(self, client, reply, (size_t) size);
+}
+
+static void handle_above(Arbiter *self, int client, unsigned long id, int reg, float threshold)
+{
+    size_t i = 0u;
+    size_t n = 0u;
+    size_t size = 0u;
+    char reply[ARBITER_REPLY_SIZE];
+    size_t indices[ARBITER_MAX_ADDRESS];
+
+    if (self->fleet == NULL || reg < 0 || reg >= SDM220_N_REGISTERS) {
+        reply_error(self, client, id, "bad-register");
+        return;
+    }
+
+    n = sdm220_fleet_select_above(self->fleet, (Sdm220Register) reg, threshold, indices,
+                                  ARBITER_MAX_ADDRESS);
+
+    size = (size_t) snprintf(reply, sizeof(reply), "above %lu %d %zu", id, reg, n);
+
+    for (; i < n && size < sizeof(reply); ++i)
+        size += (size_t) snprintf(reply + size, sizeof(reply) - size, " %u",
+                                  (unsigned) self->fleet->address[indices[i]]);
+
+    if (size < sizeof(reply))
+        size += (size_t) snprintf(reply + size, sizeof(reply) - size, "\n");
+
+    send_line(self, client, reply, size < sizeof(reply) ? size : sizeof(reply));
+}
+
+/*
+ * Clients are expected to read their replies: one that lets its socket
+ * buffer fill up is dropped rather than waited for.
+ */
+static void send_line(Arbiter *self, int client, const char *line, size_t size)
+{
+    if (self->clients[client].fd < 0)
+        return;
+
+    if (send(self->clients[client].fd, line, size, MSG_DONTWAIT | MSG_NOSIGNAL) != (ssize_t) size)
+        client_close(self, client);
+}
+
+static ArbiterRequest *request_alloc(Arbiter *self)
+{
+    size_t i = 0u;
+
+    for (; i < ARBITER_MAX_REQUESTS; ++i) {
+        if (!self->requests[i].used)
+            return &self->requests[i];
+    }
+
+    return NULL;
+}
+
+static void handle_read(Arbiter *self, int client, unsigned long id, unsigned long address,
+                        unsigned long mask, long priority, unsigned long max_age)
+{
+    int reg = 0;
+    double value = 0.0;
+    Sdm220Meter *meter = NULL;
+    Sdm220RegisterMask stale = 0u;
+    Sdm220RegisterMask before = 0u;
+    Sdm220RegisterMask added = 0u;
+    ArbiterRequest *request = NULL;
+
+    self->n_requests++;
+
+    if (address > ARBITER_MAX_ADDRESS || self->meters[address] == NULL) {
+        reply_error(self, client, id, "unknown-address");
+        return;
+    }
+
+    if (mask == 0u || (mask & ~(unsigned long) SDM220_REGISTER_MASK_ALL) != 0u) {
+        reply_error(self, client, id, "bad-mask");
+        return;
+    }
+
+    meter = self->meters[address];
+    before = sdm220_meter_refresh_pending(meter);
+
+    for (; reg < SDM220_N_REGISTERS; ++reg) {
+        if ((mask & SDM220_REGISTER_MASK(reg)) != 0u
+            && sdm220_meter_read_cached(meter, reg, max_age, &value) != SDM220_VALUE_FRESH)
+            stale |= SDM220_REGISTER_MASK(reg);
+    }
+
+    if (stale == 0u) {
+        self->cache_hits++;
+        reply_values(self, client, id, meter, mask);
+        return;
+    }
+
+    added = sdm220_meter_refresh_pending(meter) & ~before;
+
+    /*
+     * Nobody waits for what this request alone put in the refresh set.
+     */
+    request = request_alloc(self);
+    if (request == NULL) {
+        sdm220_meter_refresh_cancel(meter, added);
+        reply_error(self, client, id, "busy");
+        return;
+    }
+
+    /*
+     * Nothing new in the refresh set: every stale register was already
+     * queued or on the wire for somebody else.
+     */
+    if (added == 0u)
+        self->merged++;
+    else
+        self->queued++;
+
+    request->used = true;
+    request->client = client;
+    request->id = id;
+    request->meter = meter;
+    request->mask = mask;
+    request->priority = (int) priority;
+    request->max_age = max_age;
+    request->submitted = timer_monotonic();
+}
+
+static void handle_line(Arbiter *self, int client, char *line)
+{
+    int n = 0;
+    char command[16];
+    unsigned long id = 0u;
+    unsigned long address = 0u;
+    unsigned long mask = 0u;
+    long priority = 0;
+    unsigned long max_age = ARBITER_DEFAULT_MAX_AGE;
+    int reg = -1;
+    float threshold = 0.0f;
+
+    n = sscanf(line, "%15s %lu %lu %lx %ld %lu", command, &id, &address, &mask, &priority,
+               &max_age);
+
+    if (n >= 1 && strcmp(command, "stats") == 0)
+        reply_stats(self, client);
+    else if (n >= 4 && strcmp(command, "read") == 0)
+        handle_read(self, client, id, address, mask, priority, max_age);
+    else if (n >= 3 && strcmp(command, "total") == 0
+             && sscanf(line, "%*s %*u %d", &reg) == 1)
+        handle_total(self, client, id, reg);
+    else if (n >= 3 && strcmp(command, "above") == 0
+             && sscanf(line, "%*s %*u %d %f", &reg, &threshold) == 2)
+        handle_above(self, client, id, reg, threshold);
+    else
+        reply_error(self, client, id, "bad-request");
+}
+
+static void client_receive(Arbiter *self, int client)
+{
+    ssize_t ret = 0;
+    char *newline = NULL;
+    ArbiterClient *peer = &self->clients[client];
+
+    ret = recv(peer->fd, peer->line + peer->line_size,
+               sizeof(peer->line) - peer->line_size - 1u, MSG_DONTWAIT);
+
+    if (ret == 0 || (ret < 0 && errno != EAGAIN && errno != EINTR)) {
+        client_close(self, client);
+        return;
+    }
+
+    if (ret < 0)
+        return;
+
+    peer->line_size += (size_t) ret;
+    peer->line[peer->line_size] = '\0';
+
+    while (peer->fd >= 0 && (newline = strchr(peer->line, '\n')) != NULL) {
+        *newline = '\0';
+        handle_line(self, client, peer->line);
+
+        if (peer->fd < 0)
+            return;
+
+        peer->line_size -= (size_t) (newline + 1 - peer->line);
+        memmove(peer->line, newline + 1, peer->line_size + 1u);
+    }
+
+    if (peer->line_size == sizeof(peer->line) - 1u)
+        client_close(self, client);
+}
+
+static void accept_clients(Arbiter *self)
+{
+    int i = 0;
+    int fd = -1;
+
+    while ((fd = accept4(self->fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0) {
+        for (i = 0; i < ARBITER_MAX_CLIENTS && self->clients[i].fd >= 0; ++i) {}
+
+        if (i == ARBITER_MAX_CLIENTS) {
+            close(fd);
+            continue;
+        }
+
+        self->clients[i].fd = fd;
+        self->clients[i].line_size = 0u;
+    }
+}
+
+static void expire_requests(Arbiter *self)
+{
+    size_t i = 0u;
+    mseconds_t now = timer_monotonic();
+    ArbiterRequest *request = NULL;
+
+    for (; i < ARBITER_MAX_REQUESTS; ++i) {
+        request = &self->requests[i];
+
+        if (request->used && now - request->submitted >= ARBITER_REQUEST_TIMEOUT) {
+            request->used = false;
+            reply_error(self, request->client, request->id, "timeout");
+        }
+    }
+}
+
+/*
+ * Never blocks: takes whatever is waiting on the sockets right now.
+ */
+void arbiter_process(Arbiter *self)
+{
+    int i = 0;
+
+    if (self->fd < 0)
+        return;
+
+    accept_clients(self);
+
+    for (; i < ARBITER_MAX_CLIENTS; ++i) {
+        if (self->clients[i].fd >= 0)
+            client_receive(self, i);
+    }
+
+    expire_requests(self);
+}
+
+void arbiter_update(Arbiter *self, Sdm220Meter *meter, bool failed)
+{
+    size_t i = 0u;
+    mseconds_t now = timer_monotonic();
+    ArbiterRequest *request = NULL;
+
+    for (; i < ARBITER_MAX_REQUESTS; ++i) {
+        request = &self->requests[i];
+
+        if (!request->used || request->meter != meter)
+            continue;
+
+        if (request_satisfied(request, now)) {
+            request->used = false;
+            reply_values(self, request->client, request->id, meter, request->mask);
+        } else if (failed) {
+            request->used = false;
+            reply_error(self, request->client, request->id, "bus-error");
+        }
+    }
+
+    /*
+     * Everybody waiting on the meter got their error, nothing is left to
+     * refresh for.
+     */
+    if (failed)
+        sdm220_meter_refresh_cancel(meter, SDM220_REGISTER_MASK_ALL);
+}
+
+int arbiter_priority(Arbiter *self, Sdm220Meter *meter)
+{
+    size_t i = 0u;
+    int priority = -1;
+
+    for (; i < ARBITER_MAX_REQUESTS; ++i) {
+        if (self->requests[i].used && self->requests[i].meter == meter
+            && self->requests[i].priority > priority)
+            priority = self->requests[i].priority;
+    }
+
+    return priority;
+}
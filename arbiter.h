@@ -0,0 +1,121 @@
+/**
+ * @file arbiter.h
+ * @author Sereda Anton <sereda-anton@yandex.ru>
+ *
+ * Copyright (c) 2017 Sereda Anton
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+#ifndef ARBITER_H
+#define ARBITER_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <poll.h>
+
+#include "timer.h"
+#include "sdm220.h"
+#include "fleet.h"
+
+#define ARBITER_MAX_CLIENTS     32
+#define ARBITER_MAX_REQUESTS    256
+#define ARBITER_LINE_SIZE       256
+#define ARBITER_REPLY_SIZE      1024
+#define ARBITER_REQUEST_TIMEOUT 10000
+#define ARBITER_DEFAULT_MAX_AGE 1000
+#define ARBITER_MAX_ADDRESS     247
+
+typedef struct _Arbiter Arbiter;
+typedef struct _ArbiterClient ArbiterClient;
+typedef struct _ArbiterRequest ArbiterRequest;
+
+/*
+ * Local bus owner. Clients connect to a unix stream socket and send one
+ * request per line:
+ *
+ *     read <id> <address> <register mask, hex> [<priority> [<max age ms>]]
+ *     total <id> <register>
+ *     above <id> <register> <threshold>
+ *     stats
+ *
+ * and get back, once every register asked for is younger than max age:
+ *
+ *     ok <id> <address> <oldest timestamp ms> <register>=<value> ...
+ *     error <id> <reason>
+ *
+ * Site wide questions are answered from the fleet store right away, over
+ * the meters whose last poll read the register:
+ *
+ *     total <id> <register> <sum>
+ *     above <id> <register> <count> <address> ...
+ *
+ * Reads go through the meters' caches (sdm220_meter_read_cached()): what
+ * is fresh is answered on the spot, what is not joins the meter's refresh
+ * set, where requests from any number of clients for the same register
+ * collapse into one read. A refresh reads registers that are adjacent in
+ * the meter with one request, others with one request each. The bus owner
+ * serves the refresh sets, highest priority first, and reports every
+ * finished poll back through arbiter_update().
+ */
+
+struct _ArbiterClient {
+    int fd;
+    size_t line_size;
+    char line[ARBITER_LINE_SIZE];
+};
+
+struct _ArbiterRequest {
+    bool used;
+    int client;
+    unsigned long id;
+    Sdm220Meter *meter;
+    Sdm220RegisterMask mask;
+    int priority;
+    mseconds_t max_age;
+    mseconds_t submitted;   /* timer_monotonic() */
+};
+
+struct _Arbiter {
+    int fd;
+    char path[108];
+    ArbiterClient clients[ARBITER_MAX_CLIENTS];
+    ArbiterRequest requests[ARBITER_MAX_REQUESTS];
+    Sdm220Meter *meters[ARBITER_MAX_ADDRESS + 1];
+    Sdm220Fleet *fleet;
+
+    unsigned long n_requests;
+    unsigned long cache_hits;   /* answered without touching the bus */
+    unsigned long merged;       /* joined a read somebody else had queued */
+    unsigned long queued;       /* asked for a new bus read */
+};
+
+bool arbiter_init(Arbiter *self, const char *path);
+void arbiter_destroy(Arbiter *self);
+void arbiter_add_meter(Arbiter *self, Sdm220Meter *meter);
+void arbiter_set_fleet(Arbiter *self, Sdm220Fleet *fleet);
+
+size_t arbiter_get_pollfds(Arbiter *self, struct pollfd *fds, size_t max_fds);
+void arbiter_process(Arbiter *self);
+void arbiter_update(Arbiter *self, Sdm220Meter *meter, bool failed);
+int arbiter_priority(Arbiter *self, Sdm220Meter *meter);
+
+#endif /* ARBITER_H */
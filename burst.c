@@ -0,0 +1,151 @@
+#include <math.h>
+
+#include "burst.h"
+
+void sdm220_burst_init(Sdm220Burst *self, double power_rate, double current_rate,
+                       mseconds_t min_interval, mseconds_t max_interval)
+{
+    self->power_rate = fabs(power_rate);
+    self->current_rate = fabs(current_rate);
+    self->min_interval = min_interval;
+    self->max_interval = max_interval;
+    self->interval = 0u;
+    self->due = 0u;
+    self->last_power = 0.0;
+    self->last_current = 0.0;
+    self->last_power_at = 0u;
+    self->last_current_at = 0u;
+    self->triggers = 0u;
+}
+
+/*
+ * Rate of change between two reads of the same register, each taken at
+ * the time it was actually read.
+ */
+static bool moved_fast(double rate, double *last, mseconds_t *last_at, double value,
+                       mseconds_t at)
+{
+    bool fast = false;
+
+    if (rate > 0.0 && *last_at != 0u && at > *last_at)
+        fast = fabs(value - *last) * 1000.0 / (double) (at - *last_at) > rate;
+
+    *last = value;
+    *last_at = at;
+
+    return fast;
+}
+
+bool sdm220_burst_update(Sdm220Burst *self, Sdm220Meter *meter, mseconds_t timestamp)
+{
+    bool triggered = false;
+
+    /*
+     * Reads that carried neither register (an on-demand energy read, say)
+     * say nothing about the load.
+     */
+    if ((meter->poll_mask & SDM220_BURST_MASK) == 0u)
+        return false;
+
+    if ((meter->poll_mask & SDM220_REGISTER_MASK(SDM220_REGISTER_ACTIVE_POWER)) != 0u)
+        triggered |= moved_fast(self->power_rate, &self->last_power, &self->last_power_at,
+                                meter->value_table[SDM220_REGISTER_ACTIVE_POWER],
+                                meter->timestamp_table[SDM220_REGISTER_ACTIVE_POWER]);
+
+    if ((meter->poll_mask & SDM220_REGISTER_MASK(SDM220_REGISTER_CURRENT)) != 0u)
+        triggered |= moved_fast(self->current_rate, &self->last_current, &self->last_current_at,
+                                meter->value_table[SDM220_REGISTER_CURRENT],
+                                meter->timestamp_table[SDM220_REGISTER_CURRENT]);
+
+    if (triggered) {
+        self->interval = self->min_interval;
+        self->triggers++;
+    } else if (self->interval != 0u) {
+        self->interval *= 2u;
+
+        if (self->interval >= self->max_interval)
+            self->interval = 0u;
+    }
+
+    /*
+     * Any read of the load counts, a cycle poll postpones the next burst
+     * read as well.
+     */
+    self->due = timestamp + self->interval;
+
+    return triggered;
+}
+
+void sdm220_burst_stop(Sdm220Burst *self)
+{
+    self->interval = 0u;
+}
+
+bool sdm220_burst_due(Sdm220Burst *self, mseconds_t timestamp)
+{
+    return self->interval != 0u && timestamp >= self->due;
+}
+
+mseconds_t sdm220_burst_wait(Sdm220Burst *self, mseconds_t timestamp)
+{
+    if (self->interval == 0u)
+        return self->max_interval;
+
+    return timestamp >= self->due ? 0u : self->due - timestamp;
+}
+
+void sdm220_burst_budget_init(Sdm220BurstBudget *self, double share, long capacity)
+{
+    self->share = share;
+    self->capacity = capacity;
+    self->tokens = capacity;
+    self->reads = 0u;
+    self->denied = 0u;
+    self->spent = 0.0;
+
+    timer_init(&self->refill_timer);
+}
+
+static void refill(Sdm220BurstBudget *self)
+{
+    long elapsed = timer_elapsed_us(&self->refill_timer);
+
+    timer_reset(&self->refill_timer);
+
+    self->tokens += (long) ((double) elapsed * self->share);
+
+    if (self->tokens > self->capacity)
+        self->tokens = self->capacity;
+}
+
+bool sdm220_burst_budget_acquire(Sdm220BurstBudget *self)
+{
+    refill(self);
+
+    if (self->tokens <= 0) {
+        self->denied++;
+        return false;
+    }
+
+    return true;
+}
+
+/*
+ * How long until the debt is paid off and the next burst read may go out.
+ */
+mseconds_t sdm220_burst_budget_wait(Sdm220BurstBudget *self)
+{
+    refill(self);
+
+    if (self->tokens > 0 || self->share <= 0.0)
+        return 0u;
+
+    return (mseconds_t) ((double) -self->tokens / self->share / 1000.0) + 1u;
+}
+
+void sdm220_burst_budget_charge(Sdm220BurstBudget *self, long used)
+{
+    self->tokens -= used;
+    self->spent += (double) used;
+    self->reads++;
+}
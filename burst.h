@@ -0,0 +1,97 @@
+/**
+ * @file burst.h
+ * @author Sereda Anton <sereda-anton@yandex.ru>
+ *
+ * Copyright (c) 2017 Sereda Anton
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+#ifndef BURST_H
+#define BURST_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "timer.h"
+#include "sdm220.h"
+
+/*
+ * A burst read only carries the registers that trigger it.
+ */
+#define SDM220_BURST_MASK   (SDM220_REGISTER_MASK(SDM220_REGISTER_CURRENT) \
+                             | SDM220_REGISTER_MASK(SDM220_REGISTER_ACTIVE_POWER))
+
+typedef struct _Sdm220Burst Sdm220Burst;
+typedef struct _Sdm220BurstBudget Sdm220BurstBudget;
+
+/*
+ * Per meter trigger. A read where active power or current moved faster
+ * than the configured rate since the previous one starts (or restarts) a
+ * burst: the meter is due again after min_interval. Every calm read after
+ * that doubles the interval, once it reaches max_interval the meter is back
+ * on the normal cadence.
+ *
+ * A rate of 0 disables that register as a trigger.
+ */
+struct _Sdm220Burst {
+    double power_rate;      /* W/s */
+    double current_rate;    /* A/s */
+    mseconds_t min_interval;
+    mseconds_t max_interval;
+    mseconds_t interval;    /* 0 while not bursting */
+    mseconds_t due;
+    double last_power;
+    double last_current;
+    mseconds_t last_power_at;
+    mseconds_t last_current_at;
+    unsigned long triggers;
+};
+
+/*
+ * Token bucket of bus time shared by all burst reads: it fills at 'share'
+ * of wall clock time up to 'capacity'. Reads are charged what they actually
+ * took, so the bucket may go into debt after a slow one and bursts wait
+ * until it is paid off.
+ */
+struct _Sdm220BurstBudget {
+    double share;
+    long capacity;  /* usec */
+    long tokens;    /* usec */
+    Timer refill_timer;
+    unsigned long reads;
+    unsigned long denied;
+    double spent;   /* usec */
+};
+
+void sdm220_burst_init(Sdm220Burst *self, double power_rate, double current_rate,
+                       mseconds_t min_interval, mseconds_t max_interval);
+bool sdm220_burst_update(Sdm220Burst *self, Sdm220Meter *meter, mseconds_t timestamp);
+void sdm220_burst_stop(Sdm220Burst *self);
+bool sdm220_burst_due(Sdm220Burst *self, mseconds_t timestamp);
+mseconds_t sdm220_burst_wait(Sdm220Burst *self, mseconds_t timestamp);
+
+void sdm220_burst_budget_init(Sdm220BurstBudget *self, double share, long capacity);
+bool sdm220_burst_budget_acquire(Sdm220BurstBudget *self);
+mseconds_t sdm220_burst_budget_wait(Sdm220BurstBudget *self);
+void sdm220_burst_budget_charge(Sdm220BurstBudget *self, long used);
+
+#endif /* BURST_H */
@@ -0,0 +1,130 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/timerfd.h>
+
+#include "cycle-timer.h"
+
+#define NSECONDS_PER_MSECOND 1000000L
+#define NSECONDS_PER_SECOND  1000000000L
+
+static inline int64_t timespec_to_nsec(struct timespec *ts)
+{
+    return (int64_t) ts->tv_sec * NSECONDS_PER_SECOND + ts->tv_nsec;
+}
+
+static inline void nsec_to_timespec(int64_t nsec, struct timespec *ts)
+{
+    ts->tv_sec = (time_t) (nsec / NSECONDS_PER_SECOND);
+    ts->tv_nsec = (long) (nsec % NSECONDS_PER_SECOND);
+}
+
+void cycle_timer_init(CycleTimer *self, mseconds_t interval)
+{
+    int64_t now = 0;
+    int64_t period = 0;
+    struct timespec ts = {0, };
+    struct itimerspec spec;
+
+    if (interval == 0u) {
+        fprintf(stderr, "Bad cycle interval: %lu.\n", interval);
+        exit(EXIT_FAILURE);
+    }
+
+    self->fd = timerfd_create(CLOCK_REALTIME, TFD_CLOEXEC);
+    if (self->fd < 0) {
+        perror("timerfd_create");
+        exit(EXIT_FAILURE);
+    }
+
+    if (clock_gettime(CLOCK_REALTIME, &ts) != 0) {
+        perror("clock_gettime");
+        exit(EXIT_FAILURE);
+    }
+
+    /*
+     * First deadline is the next wall-clock multiple of the interval.
+     */
+    now = timespec_to_nsec(&ts);
+    period = (int64_t) interval * NSECONDS_PER_MSECOND;
+
+    memset(&spec, 0, sizeof(spec));
+    nsec_to_timespec((now / period + 1) * period, &spec.it_value);
+    nsec_to_timespec(period, &spec.it_interval);
+
+    if (timerfd_settime(self->fd, TFD_TIMER_ABSTIME, &spec, NULL) != 0) {
+        perror("timerfd_settime");
+        exit(EXIT_FAILURE);
+    }
+
+    self->interval = interval;
+    self->cycles = 0u;
+    self->overruns = 0u;
+    self->jitter_min = 0;
+    self->jitter_max = 0;
+    self->jitter_sum = 0.0;
+}
+
+void cycle_timer_destroy(CycleTimer *self)
+{
+    if (self->fd >= 0)
+        close(self->fd);
+
+    self->fd = -1;
+}
+
+bool cycle_timer_wait(CycleTimer *self)
+{
+    ssize_t ret = 0;
+    long jitter = 0;
+    int64_t now = 0;
+    int64_t period = 0;
+    uint64_t expirations = 0u;
+    struct timespec ts = {0, };
+
+    ret = read(self->fd, &expirations, sizeof(expirations));
+    if (ret < 0) {
+        if (errno == EINTR)
+            return false;
+
+        perror("read");
+        exit(EXIT_FAILURE);
+    }
+
+    if (clock_gettime(CLOCK_REALTIME, &ts) != 0) {
+        perror("clock_gettime");
+        exit(EXIT_FAILURE);
+    }
+
+    /*
+     * More than one expiration means whole cycles went by while the caller
+     * was still busy: they are dropped, only the latest deadline is served.
+     */
+    if (expirations > 1u)
+        self->overruns += (unsigned long) (expirations - 1u);
+
+    now = timespec_to_nsec(&ts);
+    period = (int64_t) self->interval * NSECONDS_PER_MSECOND;
+    jitter = (long) ((now % period) / 1000);
+
+    if (self->cycles == 0u || jitter < self->jitter_min)
+        self->jitter_min = jitter;
+
+    if (self->cycles == 0u || jitter > self->jitter_max)
+        self->jitter_max = jitter;
+
+    self->jitter_sum += (double) jitter;
+    self->cycles++;
+
+    return true;
+}
+
+double cycle_timer_jitter_mean(CycleTimer *self)
+{
+    if (self->cycles == 0u)
+        return 0.0;
+
+    return self->jitter_sum / (double) self->cycles;
+}
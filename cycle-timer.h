@@ -0,0 +1,59 @@
+/**
+ * @file cycle-timer.h
+ * @author Sereda Anton <sereda-anton@yandex.ru>
+ *
+ * Copyright (c) 2017 Sereda Anton
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+#ifndef CYCLE_TIMER_H
+#define CYCLE_TIMER_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "timer.h"
+
+typedef struct _CycleTimer CycleTimer;
+
+/*
+ * Periodic wake-up aligned to wall-clock multiples of the interval (an
+ * interval of 1000 ms fires at every :00.000 second). Deadlines are absolute,
+ * so the schedule never drifts; cycles missed while the caller was busy are
+ * skipped and counted as overruns instead of being replayed back to back.
+ */
+struct _CycleTimer {
+    int fd;
+    mseconds_t interval;
+    unsigned long cycles;
+    unsigned long overruns;
+    long jitter_min;    /* usec */
+    long jitter_max;    /* usec */
+    double jitter_sum;  /* usec */
+};
+
+void cycle_timer_init(CycleTimer *self, mseconds_t interval);
+void cycle_timer_destroy(CycleTimer *self);
+bool cycle_timer_wait(CycleTimer *self);
+double cycle_timer_jitter_mean(CycleTimer *self);
+
+#endif /* CYCLE_TIMER_H */
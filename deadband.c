@@ -0,0 +1,95 @@
+#include <string.h>
+#include <math.h>
+
+#include "deadband.h"
+
+void sdm220_deadband_init(Sdm220Deadband *self, mseconds_t heartbeat,
+                          Sdm220DeadbandChangedCallback callback, void *user_data)
+{
+    size_t i = 0u;
+
+    for (; i < SDM220_VALUE_TABLE_SIZE; ++i) {
+        self->rules[i].kind = SDM220_DEADBAND_ABSOLUTE;
+        self->rules[i].value = 0.0;
+    }
+
+    self->heartbeat = heartbeat;
+    self->callback = callback;
+    self->user_data = user_data;
+
+    sdm220_deadband_reset(self);
+}
+
+void sdm220_deadband_set(Sdm220Deadband *self, Sdm220Register reg, Sdm220DeadbandKind kind,
+                         double value)
+{
+    if ((int) reg < 0 || reg >= SDM220_N_REGISTERS)
+        return;
+
+    self->rules[reg].kind = kind;
+    self->rules[reg].value = fabs(value);
+}
+
+void sdm220_deadband_reset(Sdm220Deadband *self)
+{
+    memset(self->reported, 0, SDM220_VALUE_TABLE_SIZE * sizeof(double));
+    memset(self->reported_at, 0, SDM220_VALUE_TABLE_SIZE * sizeof(mseconds_t));
+
+    self->reported_mask = 0u;
+}
+
+static inline bool is_outside(Sdm220DeadbandRule *rule, double reported, double value)
+{
+    double band = 0.0;
+
+    if (isnan(value) || isnan(reported))
+        return isnan(value) != isnan(reported);
+
+    if (rule->kind == SDM220_DEADBAND_PERCENT)
+        band = fabs(reported) * rule->value / 100.0;
+    else
+        band = rule->value;
+
+    if (band == 0.0)
+        return value != reported;
+
+    return fabs(value - reported) > band;
+}
+
+Sdm220RegisterMask sdm220_deadband_update(Sdm220Deadband *self, Sdm220Meter *meter,
+                                          mseconds_t timestamp)
+{
+    size_t i = 0u;
+    double value = 0.0;
+    Sdm220RegisterMask bit = 0u;
+    Sdm220RegisterMask changed = 0u;
+
+    /*
+     * Registers this read did not carry hold old values, they are looked
+     * at again when they are read.
+     */
+    for (; i < SDM220_VALUE_TABLE_SIZE; ++i) {
+        bit = SDM220_REGISTER_MASK(i);
+        if ((meter->poll_mask & bit) == 0u)
+            continue;
+
+        value = meter->value_table[i];
+
+        if ((self->reported_mask & bit) == 0u
+            || is_outside(&self->rules[i], self->reported[i], value)
+            || (self->heartbeat != 0u
+                && timestamp - self->reported_at[i] >= self->heartbeat)) {
+
+            self->reported[i] = value;
+            self->reported_at[i] = timestamp;
+            changed |= bit;
+        }
+    }
+
+    self->reported_mask |= changed;
+
+    if (changed != 0u && self->callback != NULL)
+        self->callback(meter, changed, self->user_data);
+
+    return changed;
+}
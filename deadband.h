@@ -0,0 +1,78 @@
+/**
+ * @file deadband.h
+ * @author Sereda Anton <sereda-anton@yandex.ru>
+ *
+ * Copyright (c) 2017 Sereda Anton
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+#ifndef DEADBAND_H
+#define DEADBAND_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "timer.h"
+#include "sdm220.h"
+
+typedef struct _Sdm220Deadband Sdm220Deadband;
+typedef struct _Sdm220DeadbandRule Sdm220DeadbandRule;
+typedef enum _Sdm220DeadbandKind Sdm220DeadbandKind;
+
+/*
+ * Receives the meter and the set of registers that moved out of their
+ * deadband (or hit the heartbeat) since they were last reported.
+ */
+typedef void (*Sdm220DeadbandChangedCallback)(Sdm220Meter *, Sdm220RegisterMask, void *);
+
+enum _Sdm220DeadbandKind {
+    SDM220_DEADBAND_ABSOLUTE = 1,
+    SDM220_DEADBAND_PERCENT
+};
+
+struct _Sdm220DeadbandRule {
+    Sdm220DeadbandKind kind;
+    double value;
+};
+
+struct _Sdm220Deadband {
+    Sdm220DeadbandRule rules[SDM220_VALUE_TABLE_SIZE];
+    double reported[SDM220_VALUE_TABLE_SIZE];
+    mseconds_t reported_at[SDM220_VALUE_TABLE_SIZE];
+    Sdm220RegisterMask reported_mask;
+    mseconds_t heartbeat;
+    Sdm220DeadbandChangedCallback callback;
+    void *user_data;
+};
+
+void sdm220_deadband_init(Sdm220Deadband *self, mseconds_t heartbeat,
+                          Sdm220DeadbandChangedCallback callback, void *user_data);
+
+void sdm220_deadband_set(Sdm220Deadband *self, Sdm220Register reg, Sdm220DeadbandKind kind,
+                         double value);
+
+Sdm220RegisterMask sdm220_deadband_update(Sdm220Deadband *self, Sdm220Meter *meter,
+                                          mseconds_t timestamp);
+
+void sdm220_deadband_reset(Sdm220Deadband *self);
+
+#endif /* DEADBAND_H */
@@ -0,0 +1,208 @@
+#include <string.h>
+
+#include "modbus.h"
+#include "discovery.h"
+
+#define discovery_from_istream(istream) \
+    ((Discovery *) ((char *) (istream) - offsetof(Discovery, istream)))
+
+/*
+ * Bits per character on the line (start, 8 data, parity or second stop, stop)
+ * and characters per probe: request, response and the 3.5 character silent
+ * interval on both sides.
+ */
+#define BITS_PER_CHAR       11u
+#define CHARS_PER_PROBE     (MODBUS_RTU_REQUEST_SIZE + 9u + 7u)
+
+/*
+ * Identification probes, walked in order until one settles the model.
+ */
+enum {
+    PROBE_PRESENCE = 0,
+    PROBE_LINE_VOLTAGE,
+    PROBE_DONE
+};
+
+enum {
+    RESULT_NONE = 0,
+    RESULT_EXCEPTION,
+    RESULT_DATA
+};
+
+static const uint16_t probe_registers[PROBE_DONE] = {
+    [PROBE_PRESENCE]        = 0x0000,   /* line to neutral volts, every Eastron meter */
+    [PROBE_LINE_VOLTAGE]    = 0x00c8    /* line 1 to line 2 volts, three phase only */
+};
+
+static const char *model_names[] = {
+    [DISCOVERY_MODEL_UNKNOWN]   = "unknown",
+    [DISCOVERY_MODEL_SINGLE_PHASE] = "SDM1xx/2xx",
+    [DISCOVERY_MODEL_SDM630]    = "SDM630"
+};
+
+static int discovery_task(Task *task);
+
+static bool read_byte_impl(InputStream *istream, uint8_t *byte)
+{
+    return transport_read_byte(discovery_from_istream(istream)->transport, byte);
+}
+
+static bool poll_impl(InputStream *istream)
+{
+    return transport_poll(discovery_from_istream(istream)->transport);
+}
+
+mseconds_t discovery_timeout(unsigned baud_rate, mseconds_t turnaround)
+{
+    return (CHARS_PER_PROBE * BITS_PER_CHAR * 1000u + baud_rate - 1u) / baud_rate + turnaround;
+}
+
+void discovery_init(Discovery *self, Transport *transport, mseconds_t timeout,
+                    DiscoveryFoundCallback callback, void *user_data)
+{
+    input_stream_init(&self->istream, read_byte_impl, poll_impl);
+    task_init(&self->task, discovery_task, self);
+    timer_init(&self->latency_timer);
+
+    memset(self->buffer, 0, DISCOVERY_BUFFER_SIZE);
+
+    self->transport = transport;
+    self->timeout = timeout;
+    self->address = DISCOVERY_FIRST_ADDRESS;
+    self->step = PROBE_PRESENCE;
+    self->result = RESULT_NONE;
+    self->data_size = 0u;
+    self->latency = 0u;
+    self->model = DISCOVERY_MODEL_UNKNOWN;
+    self->present = false;
+    self->found = 0u;
+    self->callback = callback;
+    self->user_data = user_data;
+}
+
+Task *discovery_get_task(Discovery *self)
+{
+    return &self->task;
+}
+
+const char *discovery_model_name(DiscoveryModel model)
+{
+    if ((int) model < 0 || model > DISCOVERY_MODEL_SDM630)
+        return model_names[DISCOVERY_MODEL_UNKNOWN];
+
+    return model_names[model];
+}
+
+/*
+ * A reply to an address we already gave up on must not be taken for the
+ * next one.
+ */
+static void drain(Discovery *self)
+{
+    uint8_t byte = 0u;
+
+    if (self->transport->concurrent)
+        return;
+
+    while (transport_poll(self->transport) && transport_read_byte(self->transport, &byte)) {}
+}
+
+static int check_header(Discovery *self)
+{
+    if (task_failed(&self->task) || self->task.io_size != 3u)
+        return RESULT_NONE;
+
+    if (self->buffer[0] != self->address)
+        return RESULT_NONE;
+
+    if (self->buffer[1] == (MODBUS_READ_INPUT_REGISTERS | MODBUS_EXCEPTION_FLAG)) {
+        self->data_size = 2u;
+        return RESULT_EXCEPTION;
+    }
+
+    if (self->buffer[1] != MODBUS_READ_INPUT_REGISTERS || self->buffer[2] == 0u
+        || self->buffer[2] + 5u > DISCOVERY_BUFFER_SIZE)
+        return RESULT_NONE;
+
+    self->data_size = (size_t) (self->buffer[2] + 2u);
+    return RESULT_DATA;
+}
+
+static int check_body(Discovery *self)
+{
+    if (task_failed(&self->task) || self->task.io_size != self->data_size)
+        return RESULT_NONE;
+
+    if (!modbus_crc16_check(self->buffer, self->data_size + 3u))
+        return RESULT_NONE;
+
+    return self->result;
+}
+
+/*
+ * Model heuristic: anything answering the voltage register with data speaks
+ * the Eastron input register map. Line to line voltage only exists on three
+ * phase meters. SDM120 and SDM220 share their input register map (total
+ * energy at 0x0156 included, on all but the earliest SDM120), so no read
+ * tells them apart and both are reported as SDM1xx/2xx. Other devices
+ * answer the first probe with an exception, they are reported as unknown.
+ */
+static int next_step(Discovery *self)
+{
+    switch (self->step) {
+    case PROBE_PRESENCE:
+        self->present = self->result != RESULT_NONE;
+        self->latency = timer_elapsed(&self->latency_timer);
+
+        return self->result == RESULT_DATA ? PROBE_LINE_VOLTAGE : PROBE_DONE;
+
+    case PROBE_LINE_VOLTAGE:
+        self->model = self->result == RESULT_DATA
+            ? DISCOVERY_MODEL_SDM630 : DISCOVERY_MODEL_SINGLE_PHASE;
+        return PROBE_DONE;
+    }
+
+    return PROBE_DONE;
+}
+
+static int discovery_task(Task *task)
+{
+    Discovery *self = task->user_data;
+    uint8_t query[MODBUS_RTU_REQUEST_SIZE];
+
+    TASK_BEGIN(task);
+
+    for (self->address = DISCOVERY_FIRST_ADDRESS; ; self->address++) {
+        self->model = DISCOVERY_MODEL_UNKNOWN;
+        self->present = false;
+
+        for (self->step = PROBE_PRESENCE; self->step != PROBE_DONE; self->step = next_step(self)) {
+            drain(self);
+
+            modbus_build_read_request(query, self->address, MODBUS_READ_INPUT_REGISTERS,
+                                      probe_registers[self->step], 2u);
+            timer_start(&self->latency_timer);
+            await_write(task, self->transport, query, sizeof(query));
+
+            await_read(task, &self->istream, self->buffer, 3u, self->timeout);
+            self->result = check_header(self);
+            if (self->result == RESULT_NONE)
+                continue;
+
+            await_read(task, &self->istream, self->buffer + 3u, self->data_size, self->timeout);
+            self->result = check_body(self);
+        }
+
+        if (self->present) {
+            self->found++;
+
+            if (self->callback != NULL)
+                self->callback(self, self->address, self->model, self->latency, self->user_data);
+        }
+
+        if (self->address == DISCOVERY_LAST_ADDRESS)
+            break;
+    }
+
+    TASK_END(task);
+}
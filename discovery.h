@@ -0,0 +1,92 @@
+/**
+ * @file discovery.h
+ * @author Sereda Anton <sereda-anton@yandex.ru>
+ *
+ * Copyright (c) 2017 Sereda Anton
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+#ifndef DISCOVERY_H
+#define DISCOVERY_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "timer.h"
+#include "task.h"
+#include "input-stream.h"
+#include "transport.h"
+
+#define DISCOVERY_FIRST_ADDRESS         1
+#define DISCOVERY_LAST_ADDRESS          247
+#define DISCOVERY_DEFAULT_TURNAROUND    50
+#define DISCOVERY_NETWORK_MARGIN        50    /* round trip to a TCP gateway */
+#define DISCOVERY_BUFFER_SIZE           16
+
+typedef struct _Discovery Discovery;
+typedef enum _DiscoveryModel DiscoveryModel;
+
+typedef void (*DiscoveryFoundCallback)(Discovery *, uint8_t, DiscoveryModel, mseconds_t, void *);
+
+enum _DiscoveryModel {
+    DISCOVERY_MODEL_UNKNOWN = 0,    /* answers, but not with the Eastron register map */
+    DISCOVERY_MODEL_SINGLE_PHASE,   /* SDM120 or SDM220, the register maps match */
+    DISCOVERY_MODEL_SDM630
+};
+
+/*
+ * Scan of one bus: every address gets a minimal FC04 read (two registers)
+ * and is given up after a timeout derived from the line speed, not a fixed
+ * one. A discovery is a Task, so the scans of all ports run side by side
+ * in one TaskLoop.
+ */
+struct _Discovery {
+    Task task;
+    InputStream istream;
+    Transport *transport;
+    mseconds_t timeout;
+    uint8_t address;
+    int step;
+    int result;
+    size_t data_size;
+    uint8_t buffer[DISCOVERY_BUFFER_SIZE];
+    Timer latency_timer;
+    mseconds_t latency;
+    DiscoveryModel model;
+    bool present;
+    unsigned found;
+    DiscoveryFoundCallback callback;
+    void *user_data;
+};
+
+/*
+ * Time one probe takes on the wire at the given line speed, plus the time
+ * a meter is allowed to think before it answers.
+ */
+mseconds_t discovery_timeout(unsigned baud_rate, mseconds_t turnaround);
+
+void discovery_init(Discovery *self, Transport *transport, mseconds_t timeout,
+                    DiscoveryFoundCallback callback, void *user_data);
+Task *discovery_get_task(Discovery *self);
+const char *discovery_model_name(DiscoveryModel model);
+
+#endif /* DISCOVERY_H */
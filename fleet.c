@@ -0,0 +1,263 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "fleet.h"
+
+#define CACHE_LINE_SIZE 64u
+
+/*
+ * Columns are padded to a whole number of cache lines of floats so every
+ * column starts aligned and the tail needs no scalar epilogue.
+ */
+#define COLUMN_STRIDE   (CACHE_LINE_SIZE / sizeof(float))
+#define SUM_LANES       COLUMN_STRIDE
+
+static void *column_alloc(size_t size)
+{
+    void *column = NULL;
+
+    if (posix_memalign(&column, CACHE_LINE_SIZE, size) != 0)
+        return NULL;
+
+    memset(column, 0, size);
+    return column;
+}
+
+bool sdm220_fleet_init(Sdm220Fleet *self, size_t capacity)
+{
+    size_t i = 0u;
+
+    memset(self, 0, sizeof(Sdm220Fleet));
+
+    capacity = (capacity + COLUMN_STRIDE - 1u) / COLUMN_STRIDE * COLUMN_STRIDE;
+
+    self->capacity = capacity;
+    self->size = 0u;
+    self->address = column_alloc(capacity * sizeof(uint8_t));
+
+    if (self->address == NULL) {
+        sdm220_fleet_destroy(self);
+        return false;
+    }
+
+    for (; i < SDM220_N_REGISTERS; ++i) {
+        self->quality[i] = column_alloc(capacity * sizeof(uint8_t));
+        self->timestamp[i] = column_alloc(capacity * sizeof(mseconds_t));
+        self->values[i] = column_alloc(capacity * sizeof(float));
+
+        if (self->quality[i] == NULL || self->timestamp[i] == NULL || self->values[i] == NULL) {
+            sdm220_fleet_destroy(self);
+            return false;
+        }
+    }
+
+    return true;
+}
+
+void sdm220_fleet_destroy(Sdm220Fleet *self)
+{
+    size_t i = 0u;
+
+    free(self->address);
+
+    for (; i < SDM220_N_REGISTERS; ++i) {
+        free(self->quality[i]);
+        free(self->timestamp[i]);
+        free(self->values[i]);
+    }
+
+    memset(self, 0, sizeof(Sdm220Fleet));
+}
+
+size_t sdm220_fleet_add(Sdm220Fleet *self, uint8_t address)
+{
+    size_t i = 0u;
+    size_t index = 0u;
+
+    if (self->size == self->capacity)
+        return SDM220_FLEET_INVALID;
+
+    index = self->size++;
+
+    self->address[index] = address;
+
+    for (; i < SDM220_N_REGISTERS; ++i) {
+        self->quality[i][index] = SDM220_FLEET_QUALITY_NONE;
+        self->timestamp[i][index] = 0u;
+    }
+
+    return index;
+}
+
+/*
+ * Only the registers the meter just read are stored, with the time each
+ * one was read. The others keep their older value, which no longer counts
+ * as good.
+ */
+void sdm220_fleet_store(Sdm220Fleet *self, size_t index, Sdm220Meter *meter)
+{
+    size_t i = 0u;
+
+    if (index >= self->size)
+        return;
+
+    for (; i < SDM220_N_REGISTERS; ++i) {
+        if ((meter->poll_mask & SDM220_REGISTER_MASK(i)) != 0u) {
+            self->values[i][index] = (float) meter->value_table[i];
+            self->timestamp[i][index] = meter->timestamp_table[i];
+            self->quality[i][index] = SDM220_FLEET_QUALITY_GOOD;
+        } else if (self->quality[i][index] == SDM220_FLEET_QUALITY_GOOD) {
+            self->quality[i][index] = SDM220_FLEET_QUALITY_STALE;
+        }
+    }
+}
+
+void sdm220_fleet_mark_stale(Sdm220Fleet *self, size_t index)
+{
+    size_t i = 0u;
+
+    if (index >= self->size)
+        return;
+
+    for (; i < SDM220_N_REGISTERS; ++i) {
+        if (self->quality[i][index] == SDM220_FLEET_QUALITY_GOOD)
+            self->quality[i][index] = SDM220_FLEET_QUALITY_STALE;
+    }
+}
+
+float sdm220_fleet_get(Sdm220Fleet *self, size_t index, Sdm220Register reg)
+{
+    if (index >= self->size || (int) reg < 0 || reg >= SDM220_N_REGISTERS)
+        return 0.0f;
+
+    return self->values[reg][index];
+}
+
+/*
+ * The scans below run over whole blocks of COLUMN_STRIDE entries: columns
+ * are padded and the padding has quality NONE, so the tail needs neither a
+ * scalar epilogue nor a bounds check. They have no branches: a meter that
+ * does not count is masked away, so the compiler can turn them into SIMD
+ * loops.
+ */
+static inline size_t scan_size(Sdm220Fleet *self)
+{
+    return (self->size + COLUMN_STRIDE - 1u) / COLUMN_STRIDE * COLUMN_STRIDE;
+}
+
+/*
+ * All ones for a meter that counts, 0 otherwise. Multiplying by 1.0 or 0.0
+ * instead gets turned back into a branch, and would keep a NaN read from
+ * a stale register.
+ */
+static inline float mask_value(float value, uint8_t quality)
+{
+    uint32_t bits = 0u;
+
+    memcpy(&bits, &value, sizeof(bits));
+    bits &= -(uint32_t) (quality == SDM220_FLEET_QUALITY_GOOD);
+    memcpy(&value, &bits, sizeof(bits));
+
+    return value;
+}
+
+/*
+ * Floating point addition is not associative, so a single accumulator
+ * forces an in order reduction that cannot be vectorized. Independent
+ * lanes (summed at the end) can.
+ */
+double sdm220_fleet_sum(Sdm220Fleet *self, Sdm220Register reg)
+{
+    size_t i = 0u;
+    size_t j = 0u;
+    size_t size = scan_size(self);
+    double sum = 0.0;
+    double lanes[SUM_LANES] = {0.0, };
+    const float *restrict values = NULL;
+    const uint8_t *restrict quality = NULL;
+
+    if ((int) reg < 0 || reg >= SDM220_N_REGISTERS)
+        return 0.0;
+
+    values = self->values[reg];
+    quality = self->quality[reg];
+
+    for (; i < size; i += SUM_LANES) {
+        for (j = 0u; j < SUM_LANES; ++j)
+            lanes[j] += (double) mask_value(values[i + j], quality[i + j]);
+    }
+
+    for (j = 0u; j < SUM_LANES; ++j)
+        sum += lanes[j];
+
+    return sum;
+}
+
+size_t sdm220_fleet_count_above(Sdm220Fleet *self, Sdm220Register reg, float threshold)
+{
+    size_t i = 0u;
+    size_t size = scan_size(self);
+    unsigned count = 0u;
+    const float *restrict values = NULL;
+    const uint8_t *restrict quality = NULL;
+
+    if ((int) reg < 0 || reg >= SDM220_N_REGISTERS)
+        return 0u;
+
+    values = self->values[reg];
+    quality = self->quality[reg];
+
+    for (; i < size; ++i)
+        count += (unsigned) ((values[i] > threshold) & (quality[i] == SDM220_FLEET_QUALITY_GOOD));
+
+    return count;
+}
+
+/*
+ * One block at a time: the hits of a block are computed in a vector loop,
+ * then compacted into indices without branches (every entry is written,
+ * only hits advance the cursor). The result limit is checked per block.
+ */
+size_t sdm220_fleet_select_above(Sdm220Fleet *self, Sdm220Register reg, float threshold,
+                                 size_t *indices, size_t max_indices)
+{
+    size_t i = 0u;
+    size_t j = 0u;
+    size_t found = 0u;
+    size_t count = 0u;
+    size_t size = scan_size(self);
+    uint8_t hits[COLUMN_STRIDE];
+    size_t block[COLUMN_STRIDE];
+    const float *restrict values = NULL;
+    const uint8_t *restrict quality = NULL;
+
+    if ((int) reg < 0 || reg >= SDM220_N_REGISTERS)
+        return 0u;
+
+    values = self->values[reg];
+    quality = self->quality[reg];
+
+    for (; i < size && count < max_indices; i += COLUMN_STRIDE) {
+        /*
+         * Unrolled completely (as -O3 would) this is no loop left to
+         * vectorize.
+         */
+        #pragma GCC unroll 1
+        for (j = 0u; j < COLUMN_STRIDE; ++j)
+            hits[j] = (uint8_t) ((values[i + j] > threshold)
+                                 & (quality[i + j] == SDM220_FLEET_QUALITY_GOOD));
+
+        for (j = 0u, found = 0u; j < COLUMN_STRIDE; ++j) {
+            block[found] = i + j;
+            found += hits[j];
+        }
+
+        if (found > max_indices - count)
+            found = max_indices - count;
+
+        memcpy(indices + count, block, found * sizeof(size_t));
+        count += found;
+    }
+
+    return count;
+}
@@ -0,0 +1,80 @@
+/**
+ * @file fleet.h
+ * @author Sereda Anton <sereda-anton@yandex.ru>
+ *
+ * Copyright (c) 2017 Sereda Anton
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+#ifndef FLEET_H
+#define FLEET_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "timer.h"
+#include "sdm220.h"
+
+#define SDM220_FLEET_INVALID    ((size_t) -1)
+
+typedef struct _Sdm220Fleet Sdm220Fleet;
+typedef enum _Sdm220FleetQuality Sdm220FleetQuality;
+
+enum _Sdm220FleetQuality {
+    SDM220_FLEET_QUALITY_NONE = 0,  /* never read */
+    SDM220_FLEET_QUALITY_GOOD,      /* read by the last poll */
+    SDM220_FLEET_QUALITY_STALE      /* not read by the last poll, value is older */
+};
+
+/*
+ * Structure of arrays store for a large number of meters: one contiguous,
+ * cache line aligned column per register, each with its own timestamp and
+ * quality column (a burst or refresh poll only reads some registers).
+ * Scanning one register across the fleet is a linear pass over a single
+ * float array and its quality.
+ *
+ * The meter registers are IEEE 754 single precision on the wire, so float
+ * columns hold them without loss at half the size of value_table.
+ */
+struct _Sdm220Fleet {
+    size_t capacity;
+    size_t size;
+    uint8_t *address;
+    uint8_t *quality[SDM220_N_REGISTERS];
+    mseconds_t *timestamp[SDM220_N_REGISTERS];
+    float *values[SDM220_N_REGISTERS];
+};
+
+bool sdm220_fleet_init(Sdm220Fleet *self, size_t capacity);
+void sdm220_fleet_destroy(Sdm220Fleet *self);
+
+size_t sdm220_fleet_add(Sdm220Fleet *self, uint8_t address);
+void sdm220_fleet_store(Sdm220Fleet *self, size_t index, Sdm220Meter *meter);
+void sdm220_fleet_mark_stale(Sdm220Fleet *self, size_t index);
+float sdm220_fleet_get(Sdm220Fleet *self, size_t index, Sdm220Register reg);
+
+double sdm220_fleet_sum(Sdm220Fleet *self, Sdm220Register reg);
+size_t sdm220_fleet_count_above(Sdm220Fleet *self, Sdm220Register reg, float threshold);
+size_t sdm220_fleet_select_above(Sdm220Fleet *self, Sdm220Register reg, float threshold,
+                                 size_t *indices, size_t max_indices);
+
+#endif /* FLEET_H */
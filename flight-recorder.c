@@ -0,0 +1,122 @@
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <stdatomic.h>
+
+#include "flight-recorder.h"
+
+#define RING_MASK (FLIGHT_RECORDER_SIZE - 1u)
+
+static FlightEvent ring[FLIGHT_RECORDER_SIZE];
+static atomic_uint_fast64_t ring_head = 0u;
+
+static const char *state_names[FLIGHT_N_STATES] = {
+    [FLIGHT_STATE_IDLE]         = "idle",
+    [FLIGHT_STATE_WAIT_HEADER]  = "waiting for response header",
+    [FLIGHT_STATE_WAIT_FRAME]   = "waiting for rest of frame",
+    [FLIGHT_STATE_RESYNC]       = "resynchronizing"
+};
+
+static inline uint64_t clock_ns(clockid_t clock)
+{
+    struct timespec now = {0, };
+
+    clock_gettime(clock, &now);
+    return (uint64_t) now.tv_sec * 1000000000u + (uint64_t) now.tv_nsec;
+}
+
+const char *flight_state_name(uint32_t state)
+{
+    if (state >= FLIGHT_N_STATES)
+        return "unknown";
+
+    return state_names[state];
+}
+
+void flight_recorder_record(FlightEventKind kind, uint16_t source, uint32_t arg,
+                            const uint8_t *data, size_t size)
+{
+    FlightEvent *event = NULL;
+    uint64_t index = atomic_fetch_add_explicit(&ring_head, 1u, memory_order_relaxed);
+
+    event = &ring[index & RING_MASK];
+
+    if (size > FLIGHT_EVENT_DATA_SIZE)
+        size = FLIGHT_EVENT_DATA_SIZE;
+
+    event->timestamp = clock_ns(CLOCK_MONOTONIC);
+    event->kind = (uint8_t) kind;
+    event->size = (uint8_t) size;
+    event->source = source;
+    event->arg = arg;
+
+    if (size != 0u)
+        memcpy(event->data, data, size);
+}
+
+static bool write_all(int fd, const void *buf, size_t size)
+{
+    ssize_t ret = 0;
+    const uint8_t *bytes = buf;
+
+    while (size != 0u) {
+        ret = write(fd, bytes, size);
+        if (ret <= 0)
+            return false;
+
+        bytes += ret;
+        size -= (size_t) ret;
+    }
+
+    return true;
+}
+
+/*
+ * NOTE: Writers are not stopped while the ring is copied out, an event
+ * recorded concurrently with the dump may come out torn.
+ */
+bool flight_recorder_dump(const char *path)
+{
+    int fd = -1;
+    bool done = false;
+    uint64_t head = 0u;
+    uint64_t first = 0u;
+    size_t count = 0u;
+    size_t offset = 0u;
+    size_t chunk = 0u;
+    FlightDumpHeader header;
+
+    head = atomic_load_explicit(&ring_head, memory_order_acquire);
+    count = head < FLIGHT_RECORDER_SIZE ? (size_t) head : FLIGHT_RECORDER_SIZE;
+    first = head - count;
+
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, FLIGHT_DUMP_MAGIC, sizeof(FLIGHT_DUMP_MAGIC));
+    header.event_size = sizeof(FlightEvent);
+    header.count = (uint32_t) count;
+    header.dropped = first;
+    header.monotonic = clock_ns(CLOCK_MONOTONIC);
+    header.realtime = clock_ns(CLOCK_REALTIME);
+
+    fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+        return false;
+
+    done = write_all(fd, &header, sizeof(header));
+
+    /*
+     * Oldest first: from the slot after the newest event to the end of the
+     * ring, then from its start.
+     */
+    offset = (size_t) (first & RING_MASK);
+    chunk = FLIGHT_RECORDER_SIZE - offset < count ? FLIGHT_RECORDER_SIZE - offset : count;
+
+    done = done && write_all(fd, &ring[offset], chunk * sizeof(FlightEvent));
+    done = done && write_all(fd, &ring[0], (count - chunk) * sizeof(FlightEvent));
+
+    if (close(fd) != 0)
+        done = false;
+
+    return done;
+}
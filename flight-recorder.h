@@ -0,0 +1,105 @@
+/**
+ * @file flight-recorder.h
+ * @author Sereda Anton <sereda-anton@yandex.ru>
+ *
+ * Copyright (c) 2017 Sereda Anton
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+#ifndef FLIGHT_RECORDER_H
+#define FLIGHT_RECORDER_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+/*
+ * Always-on record of the last FLIGHT_RECORDER_SIZE bus events, kept in a
+ * process wide ring. Recording is one relaxed atomic increment, a monotonic
+ * clock read and a 32 byte store: no locks, no allocation, safe from any
+ * thread. Older events are overwritten.
+ *
+ * The dump is a FlightDumpHeader followed by the events, oldest first, in
+ * host byte order; tools/flight-decode.c turns it into a Modbus timeline.
+ */
+
+#define FLIGHT_RECORDER_SIZE        4096    /* events, power of two */
+#define FLIGHT_EVENT_DATA_SIZE      16
+#define FLIGHT_DUMP_MAGIC           "SDMFLT1"
+
+typedef struct _FlightEvent FlightEvent;
+typedef struct _FlightDumpHeader FlightDumpHeader;
+typedef enum _FlightEventKind FlightEventKind;
+typedef enum _FlightState FlightState;
+
+/*
+ * Bus events (TX, RX, TIMEOUT) come from the transport number 'bus', meter
+ * events from the slave address.
+ */
+enum _FlightEventKind {
+    FLIGHT_EVENT_TX = 1,    /* arg: frame size */
+    FLIGHT_EVENT_RX,        /* arg: chunk size */
+    FLIGHT_EVENT_POLL,      /* arg: register mask */
+    FLIGHT_EVENT_STATE,     /* arg: FlightState */
+    FLIGHT_EVENT_TIMEOUT,   /* arg: bytes received before it */
+    FLIGHT_EVENT_ERROR      /* arg: Sdm220MeterErrorCode */
+};
+
+/*
+ * Where a meter's transaction stands, recorded on every change.
+ */
+enum _FlightState {
+    FLIGHT_STATE_IDLE = 0,      /* no transaction in flight */
+    FLIGHT_STATE_WAIT_HEADER,   /* request sent, waiting for a response header */
+    FLIGHT_STATE_WAIT_FRAME,    /* header accepted, waiting for the rest of the frame */
+    FLIGHT_STATE_RESYNC,        /* skipping bytes that do not start our response */
+    FLIGHT_N_STATES
+};
+
+struct _FlightEvent {
+    uint64_t timestamp;     /* ns, CLOCK_MONOTONIC */
+    uint8_t kind;
+    uint8_t size;           /* bytes of data kept, at most FLIGHT_EVENT_DATA_SIZE */
+    uint16_t source;        /* bus or slave address, 0 when unknown */
+    uint32_t arg;
+    uint8_t data[FLIGHT_EVENT_DATA_SIZE];
+};
+
+struct _FlightDumpHeader {
+    char magic[8];
+    uint32_t event_size;
+    uint32_t count;
+    uint64_t dropped;       /* events overwritten before the dump */
+    uint64_t monotonic;     /* ns, both clocks read at dump time */
+    uint64_t realtime;
+};
+
+void flight_recorder_record(FlightEventKind kind, uint16_t source, uint32_t arg,
+                            const uint8_t *data, size_t size);
+
+const char *flight_state_name(uint32_t state);
+
+/*
+ * Only uses async-signal-safe calls, may be called from a signal handler.
+ */
+bool flight_recorder_dump(const char *path);
+
+#endif /* FLIGHT_RECORDER_H */
@@ -54,7 +54,7 @@ static inline void notify_error_timeout(InputStream *self)
 
     runtime_error_clear(&error);
     runtime_error_set(&error,
-                      INPUT_STREAM_ERROR_OUT_OF_MEMORY, "Out of memory");
+                      INPUT_STREAM_ERROR_TIMEOUT, "Operation timeout");
 
     notify(self, &error);
 }
@@ -65,7 +65,7 @@ static inline void notify_error_out_of_memory(InputStream *self)
 
     runtime_error_clear(&error);
     runtime_error_set(&error,
-                      INPUT_STREAM_ERROR_TIMEOUT, "Operation timeout");
+                      INPUT_STREAM_ERROR_OUT_OF_MEMORY, "Out of memory");
 
     notify(self, &error);
 }
@@ -0,0 +1,310 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <sys/un.h>
+
+#include "line-export.h"
+
+#define UNIX_PREFIX "unix://"
+#define UDP_PREFIX  "udp://"
+
+static bool resolve_unix(LineExporter *self, const char *path)
+{
+    struct sockaddr_un *address = (struct sockaddr_un *) &self->address;
+
+    if (path[0] == '\0' || strlen(path) >= sizeof(address->sun_path))
+        return false;
+
+    address->sun_family = AF_UNIX;
+    strcpy(address->sun_path, path);
+    self->address_size = (socklen_t) sizeof(struct sockaddr_un);
+
+    return true;
+}
+
+static bool resolve_udp(LineExporter *self, const char *host_port)
+{
+    int ret = 0;
+    char host[256];
+    const char *colon = NULL;
+    struct addrinfo hints;
+    struct addrinfo *result = NULL;
+
+    colon = strrchr(host_port, ':');
+    if (colon == NULL || colon == host_port || (size_t) (colon - host_port) >= sizeof(host))
+        return false;
+
+    memcpy(host, host_port, (size_t) (colon - host_port));
+    host[colon - host_port] = '\0';
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_DGRAM;
+
+    ret = getaddrinfo(host, colon + 1, &hints, &result);
+    if (ret != 0) {
+        fprintf(stderr, "%s: %s\n", host_port, gai_strerror(ret));
+        return false;
+    }
+
+    memcpy(&self->address, result->ai_addr, result->ai_addrlen);
+    self->address_size = result->ai_addrlen;
+
+    freeaddrinfo(result);
+    return true;
+}
+
+/*
+ * Tag values escape commas, spaces and equals signs.
+ */
+static size_t escape_tag(char *out, size_t out_size, const char *value)
+{
+    size_t size = 0u;
+
+    for (; *value != '\0' && size + 2u < out_size; ++value) {
+        if (*value == ',' || *value == ' ' || *value == '=')
+            out[size++] = '\\';
+
+        out[size++] = *value;
+    }
+
+    out[size] = '\0';
+    return size;
+}
+
+static void build_prefixes(LineExporter *self, const char *measurement, const char *port)
+{
+    size_t i = 0u;
+    int size = 0;
+    char port_tag[LINE_EXPORTER_PREFIX_SIZE / 2];
+
+    escape_tag(port_tag, sizeof(port_tag), port);
+
+    for (; i <= LINE_EXPORTER_MAX_ADDRESS; ++i) {
+        size = snprintf(self->prefixes[i], LINE_EXPORTER_PREFIX_SIZE, "%s,port=%s,address=%zu",
+                        measurement, port_tag, i);
+
+        self->prefix_sizes[i] = size < LINE_EXPORTER_PREFIX_SIZE
+            ? (size_t) size : LINE_EXPORTER_PREFIX_SIZE - 1u;
+    }
+}
+
+bool line_exporter_init(LineExporter *self, const char *url, const char *measurement,
+                        const char *port)
+{
+    bool resolved = false;
+
+    memset(&self->address, 0, sizeof(self->address));
+
+    self->fd = -1;
+    self->head = 0u;
+    self->tail = 0u;
+    self->sent = 0u;
+    self->dropped = 0u;
+    self->send_errors = 0u;
+
+    if (strncmp(url, UNIX_PREFIX, strlen(UNIX_PREFIX)) == 0)
+        resolved = resolve_unix(self, url + strlen(UNIX_PREFIX));
+    else if (strncmp(url, UDP_PREFIX, strlen(UDP_PREFIX)) == 0)
+        resolved = resolve_udp(self, url + strlen(UDP_PREFIX));
+
+    if (!resolved)
+        return false;
+
+    self->fd = socket(self->address.ss_family, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (self->fd < 0) {
+        perror("socket");
+        return false;
+    }
+
+    build_prefixes(self, measurement, port);
+    return true;
+}
+
+void line_exporter_destroy(LineExporter *self)
+{
+    if (self->fd >= 0)
+        close(self->fd);
+
+    self->fd = -1;
+}
+
+size_t line_exporter_pending(LineExporter *self)
+{
+    return self->tail - self->head;
+}
+
+/*
+ * Claims the next slot. With the ring full the record is built on the side:
+ * the oldest one is only given up once the new one turned out to fit.
+ */
+static LineExporterRecord *queue_claim(LineExporter *self)
+{
+    LineExporterRecord *record = NULL;
+
+    if (line_exporter_pending(self) == LINE_EXPORTER_QUEUE_SIZE)
+        record = &self->spare;
+    else
+        record = &self->queue[self->tail % LINE_EXPORTER_QUEUE_SIZE];
+
+    record->size = 0u;
+
+    return record;
+}
+
+static inline void append(LineExporterRecord *record, const char *name, const char *suffix,
+                          const char *format, double value)
+{
+    int size = 0;
+    const char *separator = record->text[record->size - 1u] == ' ' ? "" : ",";
+
+    if (record->size >= LINE_EXPORTER_RECORD_SIZE)
+        return;
+
+    size = snprintf(record->text + record->size, LINE_EXPORTER_RECORD_SIZE - record->size,
+                    "%s%s%s=", separator, name, suffix);
+    record->size += (size_t) size;
+
+    if (record->size >= LINE_EXPORTER_RECORD_SIZE)
+        return;
+
+    size = snprintf(record->text + record->size, LINE_EXPORTER_RECORD_SIZE - record->size,
+                    format, value);
+    record->size += (size_t) size;
+}
+
+/*
+ * A line that did not fit is not sent truncated, it is dropped.
+ */
+static void queue_commit(LineExporter *self, LineExporterRecord *record, uint64_t timestamp)
+{
+    int size = 0;
+
+    if (record->size < LINE_EXPORTER_RECORD_SIZE)
+        size = snprintf(record->text + record->size, LINE_EXPORTER_RECORD_SIZE - record->size,
+                        " %lu\n", (unsigned long) timestamp);
+
+    if (record->size + (size_t) size >= LINE_EXPORTER_RECORD_SIZE) {
+        self->dropped++;
+        return;
+    }
+
+    record->size += (size_t) size;
+
+    if (record == &self->spare) {
+        self->head++;
+        self->dropped++;
+
+        memcpy(self->queue[self->tail % LINE_EXPORTER_QUEUE_SIZE].text, record->text,
+               record->size);
+        self->queue[self->tail % LINE_EXPORTER_QUEUE_SIZE].size = record->size;
+    }
+
+    self->tail++;
+}
+
+static void begin(LineExporterRecord *record, LineExporter *self, uint8_t address,
+                  const char *tags)
+{
+    memcpy(record->text, self->prefixes[address], self->prefix_sizes[address]);
+    record->size = self->prefix_sizes[address];
+    record->size += (size_t) snprintf(record->text + record->size,
+                                      LINE_EXPORTER_RECORD_SIZE - record->size, "%s ", tags);
+}
+
+void line_exporter_push_meter(LineExporter *self, Sdm220Meter *meter, Sdm220RegisterMask mask,
+                              uint64_t timestamp)
+{
+    int reg = 0;
+    LineExporterRecord *record = NULL;
+
+    if (self->fd < 0 || (mask & SDM220_REGISTER_MASK_ALL) == 0u)
+        return;
+
+    record = queue_claim(self);
+    begin(record, self, meter->slave_address, "");
+
+    for (; reg < SDM220_N_REGISTERS; ++reg) {
+        if ((mask & SDM220_REGISTER_MASK(reg)) != 0u)
+            append(record, sdm220_register_name(reg), "", "%.9g", meter->value_table[reg]);
+    }
+
+    queue_commit(self, record, timestamp);
+}
+
+void line_exporter_push_aggregate(LineExporter *self, Sdm220Aggregate *aggregate)
+{
+    int reg = 0;
+    LineExporterRecord *record = NULL;
+
+    if (self->fd < 0)
+        return;
+
+    record = queue_claim(self);
+    begin(record, self, aggregate->slave_address,
+          aggregate->kind == SDM220_AGGREGATE_TUMBLING ? ",window=tumbling" : ",window=sliding");
+
+    for (; reg < SDM220_N_REGISTERS; ++reg) {
+        append(record, sdm220_register_name(reg), "_mean", "%.9g", aggregate->mean[reg]);
+        append(record, sdm220_register_name(reg), "_min", "%.9g", aggregate->min[reg]);
+        append(record, sdm220_register_name(reg), "_max", "%.9g", aggregate->max[reg]);
+    }
+
+    append(record, "energy", "_wh", "%.9g", aggregate->energy);
+    append(record, "samples", "", "%.0fi", (double) aggregate->count);
+
+    queue_commit(self, record, (uint64_t) aggregate->end * 1000000u);
+}
+
+void line_exporter_flush(LineExporter *self)
+{
+    int i = 0;
+    int n = 0;
+    int ret = 0;
+    LineExporterRecord *record = NULL;
+    struct mmsghdr messages[LINE_EXPORTER_BATCH_SIZE];
+    struct iovec iovecs[LINE_EXPORTER_BATCH_SIZE];
+
+    while (self->fd >= 0 && line_exporter_pending(self) != 0u) {
+        n = line_exporter_pending(self) < LINE_EXPORTER_BATCH_SIZE
+            ? (int) line_exporter_pending(self) : LINE_EXPORTER_BATCH_SIZE;
+
+        memset(messages, 0, sizeof(messages));
+
+        for (i = 0; i < n; ++i) {
+            record = &self->queue[(self->head + (size_t) i) % LINE_EXPORTER_QUEUE_SIZE];
+
+            iovecs[i].iov_base = record->text;
+            iovecs[i].iov_len = record->size;
+
+            messages[i].msg_hdr.msg_name = &self->address;
+            messages[i].msg_hdr.msg_namelen = self->address_size;
+            messages[i].msg_hdr.msg_iov = &iovecs[i];
+            messages[i].msg_hdr.msg_iovlen = 1;
+        }
+
+        ret = sendmmsg(self->fd, messages, (unsigned int) n, MSG_DONTWAIT);
+
+        if (ret < 0) {
+            /*
+             * A full socket buffer keeps the records for the next flush. Any
+             * other failure (no collector listening) would fail them again:
+             * the batch goes.
+             */
+            if (errno == EAGAIN || errno == EWOULDBLOCK || errno == ENOBUFS || errno == EINTR)
+                return;
+
+            self->send_errors++;
+            self->dropped += (unsigned long) n;
+            self->head += (size_t) n;
+            continue;
+        }
+
+        self->sent += (unsigned long) ret;
+        self->head += (size_t) ret;
+    }
+}
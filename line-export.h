@@ -0,0 +1,92 @@
+/**
+ * @file line-export.h
+ * @author Sereda Anton <sereda-anton@yandex.ru>
+ *
+ * Copyright (c) 2017 Sereda Anton
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+#ifndef LINE_EXPORT_H
+#define LINE_EXPORT_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <sys/socket.h>
+
+#include "sdm220.h"
+#include "aggregator.h"
+
+#define LINE_EXPORTER_QUEUE_SIZE    256     /* records */
+#define LINE_EXPORTER_RECORD_SIZE   2048    /* bytes, one line */
+#define LINE_EXPORTER_BATCH_SIZE    32      /* datagrams per sendmmsg() */
+#define LINE_EXPORTER_PREFIX_SIZE   160
+#define LINE_EXPORTER_MAX_ADDRESS   247
+
+typedef struct _LineExporter LineExporter;
+typedef struct _LineExporterRecord LineExporterRecord;
+
+struct _LineExporterRecord {
+    size_t size;
+    char text[LINE_EXPORTER_RECORD_SIZE];
+};
+
+/*
+ * InfluxDB line protocol sink. Every record is one datagram, sent to a
+ * unix:///path or udp://host:port endpoint.
+ *
+ * Records are formatted straight into a bounded ring and only leave it on
+ * line_exporter_flush(), in batches and without ever blocking. A collector
+ * that does not keep up costs the oldest records (counted in 'dropped'),
+ * never time on the bus.
+ */
+struct _LineExporter {
+    int fd;
+    struct sockaddr_storage address;
+    socklen_t address_size;
+
+    /*
+     * "measurement,port=...,address=N", built once per slave address.
+     */
+    char prefixes[LINE_EXPORTER_MAX_ADDRESS + 1][LINE_EXPORTER_PREFIX_SIZE];
+    size_t prefix_sizes[LINE_EXPORTER_MAX_ADDRESS + 1];
+
+    LineExporterRecord queue[LINE_EXPORTER_QUEUE_SIZE];
+    LineExporterRecord spare;   /* built here while the queue is full */
+    size_t head;
+    size_t tail;
+
+    unsigned long sent;
+    unsigned long dropped;
+    unsigned long send_errors;
+};
+
+bool line_exporter_init(LineExporter *self, const char *url, const char *measurement,
+                        const char *port);
+void line_exporter_destroy(LineExporter *self);
+
+void line_exporter_push_meter(LineExporter *self, Sdm220Meter *meter, Sdm220RegisterMask mask,
+                              uint64_t timestamp);
+void line_exporter_push_aggregate(LineExporter *self, Sdm220Aggregate *aggregate);
+void line_exporter_flush(LineExporter *self);
+size_t line_exporter_pending(LineExporter *self);
+
+#endif /* LINE_EXPORT_H */
@@ -1,60 +1,1334 @@
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
+#include <signal.h>
 #include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
 
 #include "timer.h"
 #include "rs485.h"
+#include "modbus-tcp.h"
 #include "sdm220.h"
+#include "deadband.h"
+#include "cycle-timer.h"
+#include "worker-pool.h"
+#include "topology.h"
+#include "discovery.h"
+#include "realtime.h"
+#include "flight-recorder.h"
+#include "aggregator.h"
+#include "line-export.h"
+#include "arbiter.h"
+#include "sample-queue.h"
+#include "burst.h"
+#include "fleet.h"
 
 #define POLL_TIMEOUT    3000
 #define SDM220_ADDRESS 	1
+#define HEARTBEAT_INTERVAL  60000
+#define MAX_METERS      247
+#define IDLE_WAIT       10
+#define REPORT_TEXT_SIZE    1024
+#define MIN_TIMEOUT     100
+#define TIMEOUT_MARGIN  50
+#define TOPOLOGY_MAX_AGE        (24 * 3600 * 1000ul)
+#define TOPOLOGY_SAVE_INTERVAL  60000
+#define MAX_SCAN_PORTS  16
+#define SCAN_IDLE_WAIT  1
+#define FLIGHT_DUMP_INTERVAL    10000
+#define EXPORT_MEASUREMENT      "sdm220"
+#define ARBITER_IDLE_WAIT       1000
+#define SAMPLE_BATCH_SIZE       64
+#define CONSUMER_IDLE_WAIT      1000
+#define BURST_MIN_INTERVAL      100
+#define BURST_MAX_INTERVAL      5000    /* without a cycle to fall back to */
+#define BURST_DEFAULT_BUDGET    20      /* percent of bus time */
+
+typedef struct {
+    uint8_t address;
+    unsigned timeout;
+    bool stale;
+    size_t fleet_index;
+    Sdm220Meter meter;
+    Sdm220Meter view;   /* the consumer thread's copy of the values, with -q */
+    Sdm220Deadband deadband;
+    Sdm220Aggregator aggregator;
+    Sdm220Burst burst;
+    ModbusTcpChannel channel;
+} MeterSlot;
+
+typedef struct {
+    const char *device;
+    unsigned baud_rate;
+    bool networked;
+    Rs485Port port;
+    ModbusTcpGateway gateway;
+    ModbusTcpChannel channel;
+    Discovery discovery;
+} ScanPort;
+
+typedef struct {
+    uint8_t address;
+    Sdm220RegisterMask changed;
+    double values[SDM220_VALUE_TABLE_SIZE];
+} Report;
+
+static WorkerPool pool;
+static bool use_pool = false;
+static Rs485Port port;
+static const char *device = NULL;
+static unsigned baud_rate = 0u;
+static Topology topology;
+static const char *topology_path = NULL;
+static size_t revalidate_next = 0u;
+static ModbusTcpGateway gateway;
+static MeterSlot meters[MAX_METERS];
+static size_t n_meters = 0u;
+static bool low_latency = false;
+static int rt_priority = 0;
+static int rt_cpu = -1;
+static const char *flight_path = NULL;
+static Timer flight_dump_timer;
+static bool flight_dumped = false;
+static LineExporter exporter;
+static bool exporting = false;
+static bool aggregating = false;
+static mseconds_t aggregate_window = 0u;
+static mseconds_t aggregate_slide = 0u;
+static Arbiter arbiter;
+static Sdm220Fleet fleet;
+static bool serving = false;
+static SampleQueue samples;
+static bool use_queue = false;
+static pthread_t consumer;
+static Sdm220BurstBudget burst_budget;
+static bool bursting = false;
+static Sdm220DeadbandRule deadband_rules[SDM220_N_REGISTERS];
+static Sdm220RegisterMask deadband_mask = 0u;
+static bool poll_failed = false;
+static bool warming_up = false;
+static volatile sig_atomic_t stop_requested = 0;
 
 static void on_pwr_meter_error(Sdm220Meter *meter, Sdm220MeterError *error,
                                void *user_data)
 {
-    fprintf(stderr, "Ooops!!! Something went wrong... Code: %d\n", error->code);
-    exit(EXIT_FAILURE);
+    fprintf(stderr, "Ooops!!! Something went wrong... Address: %u, Code: %d\n",
+            (unsigned) meter->slave_address, error->code);
+
+    if (error->code == SDM220_METER_ERROR_CODE_EXCEPTION)
+        fprintf(stderr, "Modbus exception: %u\n", (unsigned) error->exception_code);
+
+    /*
+     * The ring still holds what led up to the error. A meter that keeps
+     * failing only rewrites the dump every FLIGHT_DUMP_INTERVAL.
+     */
+    if (flight_path != NULL
+        && (!flight_dumped || timer_elapsed(&flight_dump_timer) >= FLIGHT_DUMP_INTERVAL)) {
+        if (!flight_recorder_dump(flight_path))
+            perror(flight_path);
+
+        timer_start(&flight_dump_timer);
+        flight_dumped = true;
+    }
+    poll_failed = true;
+
+    sdm220_fleet_mark_stale(&fleet, ((MeterSlot *) user_data)->fleet_index);
+
+    /*
+     * The tuned timeout may be what failed, the next try gets the full one.
+     * Stale meters keep probing with the cached one so they stay cheap.
+     */
+    if (!((MeterSlot *) user_data)->stale)
+        ((MeterSlot *) user_data)->timeout = POLL_TIMEOUT;
+
+    /*
+     * A meter that stopped answering is not worth the burst budget.
+     */
+    if (bursting)
+        sdm220_burst_stop(&((MeterSlot *) user_data)->burst);
+
+    if (serving)
+        arbiter_update(&arbiter, meter, true);
+}
+
+static const char *register_labels[SDM220_N_REGISTERS] = {
+    [SDM220_REGISTER_VOLTAGE]                   = "Line to neutral volts (V):",
+    [SDM220_REGISTER_CURRENT]                   = "Current (A):",
+    [SDM220_REGISTER_ACTIVE_POWER]              = "Active power (W):",
+    [SDM220_REGISTER_APPARENT_POWER]            = "Apparent power (VA):",
+    [SDM220_REGISTER_REACTIVE_POWER]            = "Reactive power (VAr):",
+    [SDM220_REGISTER_POWER_FACTOR]              = "Power factor (None):",
+    [SDM220_REGISTER_PHASE_ANGLE]               = "Phase angle (Degree):",
+    [SDM220_REGISTER_FREQUENCY]                 = "Frequency (Hz):",
+    [SDM220_REGISTER_IMPORT_ACTIVE_ENERGY]      = "Import active energy (kWh):",
+    [SDM220_REGISTER_EXPORT_ACTIVE_ENERGY]      = "Export active energy (kWh):",
+    [SDM220_REGISTER_IMPORT_REACTIVE_ENERGY]    = "Import reactive energy (kvarh):",
+    [SDM220_REGISTER_EXPORT_REACTIVE_ENERGY]    = "Export reactive energy (kvarh):",
+    [SDM220_REGISTER_TOTAL_ACTIVE_ENERGY]       = "Total active energy (kWh):",
+    [SDM220_REGISTER_TOTAL_REACTIVE_ENERGY]     = "Total reactive energy (kvarh):"
+};
+
+static void print_report(void *payload, void *user_data)
+{
+    int reg = 0;
+    size_t size = 0u;
+    char text[REPORT_TEXT_SIZE];
+    Report *report = payload;
+
+    /*
+     * Formatted in one piece so reports printed by different workers do
+     * not interleave. Reports of one meter come out in order, they are
+     * all printed by the same worker.
+     */
+    size += (size_t) snprintf(text + size, sizeof(text) - size,
+                              "\nSDM220 Data (address %u):\n\n", (unsigned) report->address);
+
+    for (; reg < SDM220_N_REGISTERS; ++reg) {
+        if ((report->changed & SDM220_REGISTER_MASK(reg)) == 0u)
+            continue;
+
+        size += (size_t) snprintf(text + size, sizeof(text) - size, "%-40s %.2f\n",
+                                  register_labels[reg], report->values[reg]);
+    }
+
+    size += (size_t) snprintf(text + size, sizeof(text) - size, "\nAll done.\n");
+
+    fwrite(text, 1, size, stdout);
+}
+
+static void on_pwr_meter_changed(Sdm220Meter *meter, Sdm220RegisterMask changed,
+                                 void *user_data)
+{
+    Report report;
+
+    report.address = meter->slave_address;
+    report.changed = changed;
+    memcpy(report.values, meter->value_table, sizeof(report.values));
+
+    if (use_pool)
+        worker_pool_submit_ordered(&pool, report.address, print_report, &report,
+                                   sizeof(report), NULL);
+    else
+        print_report(&report, NULL);
+}
+
+static unsigned tune_timeout(mseconds_t latency)
+{
+    mseconds_t timeout = latency * 3u + TIMEOUT_MARGIN;
+
+    if (timeout < MIN_TIMEOUT)
+        return MIN_TIMEOUT;
+
+    if (timeout > POLL_TIMEOUT)
+        return POLL_TIMEOUT;
+
+    return (unsigned) timeout;
+}
+
+/*
+ * Everything that only looks at the values: runs in the ready callback, or
+ * with -q on the consumer thread.
+ */
+static void consume(MeterSlot *slot, Sdm220Meter *meter, mseconds_t now, uint64_t now_ns)
+{
+    Sdm220RegisterMask changed = sdm220_deadband_update(&slot->deadband, meter, now);
+
+    if (!exporting)
+        return;
+
+    /*
+     * With -A the collector gets the aggregates instead of the raw records.
+     * On-demand refreshes only carry a few registers, windows are built
+     * from full cycles.
+     */
+    if (aggregating) {
+        if (meter->poll_mask == SDM220_REGISTER_MASK_ALL)
+            sdm220_aggregator_push(&slot->aggregator, meter, now);
+
+        return;
+    }
+
+    /*
+     * The deadband decides for the collector as well: only registers that
+     * moved out of their band (or are due a heartbeat) go out.
+     */
+    if (changed != 0u)
+        line_exporter_push_meter(&exporter, meter, changed, now_ns);
 }
 
 static void on_pwr_meter_ready(Sdm220Meter *meter, void *user_data)
 {
-    printf("\nSDM220 Data:\n\n");
+    mseconds_t now = timer_timestamp();
+    MeterSlot *slot = user_data;
+
+    slot->stale = false;
+
+    /*
+     * Timeouts are only tuned with -t, where the tuned value is also what
+     * the cache remembers.
+     */
+    if (topology_path != NULL) {
+        slot->timeout = tune_timeout(sdm220_meter_get_latency(meter));
+        topology_update(&topology, device, meter->slave_address, baud_rate,
+                        sdm220_meter_get_latency(meter), slot->timeout, now);
+    }
+
+    if (warming_up)
+        return;
+
+    if (serving)
+        arbiter_update(&arbiter, meter, false);
+
+    if (bursting)
+        sdm220_burst_update(&slot->burst, meter, now);
+
+    sdm220_fleet_store(&fleet, slot->fleet_index, meter);
+
+    if (use_queue)
+        sample_queue_push_meter(&samples, meter, meter->poll_mask, now, timer_timestamp_ns());
+    else
+        consume(slot, meter, now, timer_timestamp_ns());
+}
+
+static MeterSlot *find_slot(uint8_t address)
+{
+    size_t i = 0u;
 
-    printf("%-40s %.2f\n", "Line to neutral volts (V):", sdm220_meter_get_voltage(meter));
-    printf("%-40s %.2f\n", "Current (A):", sdm220_meter_get_current(meter));
-    printf("%-40s %.2f\n", "Active power (W):", sdm220_meter_get_active_power(meter));
-    printf("%-40s %.2f\n", "Apparent power (VA):", sdm220_meter_get_apparent_power(meter));
-    printf("%-40s %.2f\n", "Reactive power (VAr):", sdm220_meter_get_reactive_power(meter));
-    printf("%-40s %.2f\n", "Power factor (None):", sdm220_meter_get_power_factor(meter));
-    printf("%-40s %.2f\n", "Phase angle (Degree):", sdm220_meter_get_phase_angle(meter));
-    printf("%-40s %.2f\n", "Frequency (Hz):", sdm220_meter_get_frequency(meter));
-    printf("%-40s %.2f\n", "Import active energy (kWh):", sdm220_meter_get_import_active_energy(meter));
-    printf("%-40s %.2f\n", "Export active energy (kWh):", sdm220_meter_get_export_active_energy(meter));
-    printf("%-40s %.2f\n", "Import reactive energy (kvarh):", sdm220_meter_get_import_reactive_energy(meter));
-    printf("%-40s %.2f\n", "Export reactive energy (kvarh):", sdm220_meter_get_export_reactive_energy(meter));
-    printf("%-40s %.2f\n", "Total active energy (kWh):", sdm220_meter_get_total_active_energy(meter));
-    printf("%-40s %.2f\n", "Total reactive energy (kvarh):", sdm220_meter_get_total_reactive_energy(meter));
+    for (; i < n_meters; ++i) {
+        if (meters[i].address == address)
+            return &meters[i];
+    }
 
-    printf("\nAll done.\n");
+    return NULL;
 }
 
-int main(int argc, char **argv)
+/*
+ * Drains the sample queue in batches. Each sample is loaded into the view
+ * of its meter, so deadband, export and aggregation see what they would
+ * have seen on the polling thread.
+ */
+static void *consumer_main(void *arg)
+{
+    size_t i = 0u;
+    size_t n = 0u;
+    Sample *batch = NULL;
+    MeterSlot *slot = NULL;
+
+    for (;;) {
+        n = sample_queue_peek(&samples, &batch, SAMPLE_BATCH_SIZE);
+
+        if (n == 0u) {
+            /*
+             * Whatever was pushed before the close shows up in a peek
+             * made after seeing it.
+             */
+            if (sample_queue_closed(&samples) && sample_queue_peek(&samples, &batch, 1u) == 0u)
+                break;
+
+            sample_queue_wait(&samples, CONSUMER_IDLE_WAIT);
+            continue;
+        }
+
+        for (i = 0u; i < n; ++i) {
+            slot = find_slot(batch[i].slave_address);
+            if (slot == NULL)
+                continue;
+
+            slot->view.poll_mask = batch[i].mask;
+            memcpy(slot->view.value_table, batch[i].values, sizeof(batch[i].values));
+            memcpy(slot->view.timestamp_table, batch[i].timestamps,
+                   sizeof(batch[i].timestamps));
+
+            consume(slot, &slot->view, batch[i].timestamp, batch[i].timestamp_ns);
+        }
+
+        sample_queue_release(&samples, n);
+        fflush(stdout);
+
+        if (exporting)
+            line_exporter_flush(&exporter);
+    }
+
+    return NULL;
+}
+
+static void on_aggregate(Sdm220Meter *meter, Sdm220Aggregate *aggregate, void *user_data)
+{
+    line_exporter_push_aggregate(&exporter, aggregate);
+}
+
+static void on_signal(int signum)
+{
+    stop_requested = 1;
+}
+
+static void on_dump_signal(int signum)
+{
+    int saved_errno = errno;
+
+    flight_recorder_dump(flight_path);
+    errno = saved_errno;
+}
+
+static void install_dump_signal(void)
+{
+    struct sigaction action;
+
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = on_dump_signal;
+    action.sa_flags = SA_RESTART;
+    sigemptyset(&action.sa_mask);
+
+    sigaction(SIGUSR1, &action, NULL);
+}
+
+static void usage(const char *name)
+{
+    fprintf(stderr, "Usage: %s [-i <interval ms>] [-a <address>[,<address>...]] [-b <baud rate>] "
+            "[-j <workers>] [-d <register>=<band>[%%][,...]] [-t <topology cache>] [-L] [-R <rt priority>] [-c <cpu>] "
+            "[-F <flight dump>] [-e <unix:///path | udp://host:port> [-A <window ms>[,<sliding ms>]]] "
+            "[-S <socket>] [-q <queue size>] [-T <W/s>[,<A/s>] [-B <bus %%>]] "
+            "<tty device | tcp://host[:port] | rtu+tcp://host[:port]>\n"
+            "       %s -s [-b <baud rate>] [-t <topology cache>] <device> [<device>...]\n"
+            "With -t, cached meters not heard from for a day are re-probed one per cycle,\n"
+            "at the end of the cycle and with their cached timeout.\n"
+            "With -A, aggregates over tumbling windows (and sliding windows, emitted\n"
+            "every twelfth of their length) are exported instead of the raw records;\n"
+            "a window of 0 leaves that kind out.\n",
+            name, name);
+    exit(EXIT_FAILURE);
+}
+
+static void add_meters(const char *name, char *arg)
+{
+    char *end = NULL;
+    char *token = NULL;
+    unsigned long addr = 0u;
+
+    for (token = strtok(arg, ","); token != NULL; token = strtok(NULL, ",")) {
+        addr = strtoul(token, &end, 0);
+        if (*end != '\0' || addr < 1u || addr > 247u || n_meters == MAX_METERS)
+            usage(name);
+
+        meters[n_meters++].address = (uint8_t) addr;
+    }
+}
+
+static void set_deadband(Sdm220Register reg, Sdm220DeadbandKind kind, double value)
+{
+    deadband_rules[reg].kind = kind;
+    deadband_rules[reg].value = value;
+    deadband_mask |= SDM220_REGISTER_MASK(reg);
+}
+
+/*
+ * <register>=<band>[%], comma separated, "all" stands for every register.
+ * A band ending in % is relative to the last reported value.
+ */
+static void add_deadbands(const char *name, char *arg)
+{
+    int reg = 0;
+    char *end = NULL;
+    char *token = NULL;
+    char *value = NULL;
+    double band = 0.0;
+    Sdm220Register found;
+    Sdm220DeadbandKind kind = SDM220_DEADBAND_ABSOLUTE;
+
+    for (token = strtok(arg, ","); token != NULL; token = strtok(NULL, ",")) {
+        value = strchr(token, '=');
+        if (value == NULL)
+            usage(name);
+
+        band = strtod(value + 1, &end);
+        kind = SDM220_DEADBAND_ABSOLUTE;
+
+        if (*end == '%') {
+            kind = SDM220_DEADBAND_PERCENT;
+            end++;
+        }
+
+        if (end == value + 1 || *end != '\0' || band < 0.0)
+            usage(name);
+
+        if (value - token == 3 && strncmp(token, "all", 3u) == 0) {
+            for (reg = 0; reg < SDM220_N_REGISTERS; ++reg)
+                set_deadband((Sdm220Register) reg, kind, band);
+        } else if (sdm220_register_from_name(token, (size_t) (value - token), &found))
+            set_deadband(found, kind, band);
+        else
+            usage(name);
+    }
+}
+
+static void load_topology(void)
+{
+    size_t i = 0u;
+    mseconds_t now = timer_timestamp();
+    bool explicit_addresses = n_meters != 0u;
+    TopologyEntry *entry = NULL;
+
+    topology_init(&topology, TOPOLOGY_MAX_AGE);
+    topology_load(&topology, topology_path);
+
+    /*
+     * Without explicit addresses the bus is taken as it was last seen,
+     * line speed included.
+     */
+    for (; i < topology.size && n_meters < MAX_METERS; ++i) {
+        entry = &topology.entries[i];
+
+        if (strcmp(entry->port, device) != 0)
+            continue;
+
+        if (baud_rate == 0u && entry->baud_rate != 0u)
+            baud_rate = entry->baud_rate;
+
+        if (!explicit_addresses)
+            meters[n_meters++].address = entry->address;
+    }
+
+    for (i = 0u; i < n_meters; ++i) {
+        entry = topology_find(&topology, device, meters[i].address);
+
+        if (entry == NULL)
+            continue;
+
+        if (entry->timeout != 0u)
+            meters[i].timeout = (unsigned) entry->timeout;
+
+        meters[i].stale = topology_entry_stale(&topology, entry, now);
+    }
+}
+
+static void open_meters(void)
+{
+    size_t i = 0u;
+    int reg = 0;
+    Transport *transport = NULL;
+    bool networked = false;
+
+    networked = modbus_tcp_gateway_init(&gateway, device);
+    if (networked)
+        baud_rate = 0u;
+    else {
+        rs485_init(&port, device, baud_rate);
+        transport = &port.transport;
+    }
+
+    if (!sdm220_fleet_init(&fleet, n_meters)) {
+        fprintf(stderr, "Unable to allocate the fleet store.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    for (; i < n_meters; ++i) {
+        if (networked) {
+            modbus_tcp_channel_init(&meters[i].channel, &gateway);
+            transport = &meters[i].channel.transport;
+        }
+
+        if (meters[i].timeout == 0u)
+            meters[i].timeout = POLL_TIMEOUT;
+
+        sdm220_meter_init(&meters[i].meter, transport, meters[i].address);
+        sdm220_meter_init(&meters[i].view, NULL, meters[i].address);
+        meters[i].fleet_index = sdm220_fleet_add(&fleet, meters[i].address);
+        sdm220_deadband_init(&meters[i].deadband, HEARTBEAT_INTERVAL,
+                             on_pwr_meter_changed, NULL);
+
+        for (reg = 0; reg < SDM220_N_REGISTERS; ++reg) {
+            if ((deadband_mask & SDM220_REGISTER_MASK(reg)) != 0u)
+                sdm220_deadband_set(&meters[i].deadband, (Sdm220Register) reg,
+                                    deadband_rules[reg].kind, deadband_rules[reg].value);
+        }
+        sdm220_aggregator_init(&meters[i].aggregator, aggregate_window, aggregate_slide,
+                               on_aggregate, NULL);
+    }
+}
+
+/*
+ * Cached meters not heard from for too long are not allowed to eat the
+ * cycle: only one of them is retried per cycle, after the live ones.
+ */
+static size_t pick_stale(void)
+{
+    size_t i = 0u;
+    size_t index = 0u;
+
+    for (; i < n_meters; ++i) {
+        index = (revalidate_next + i) % n_meters;
+
+        if (meters[index].stale) {
+            revalidate_next = index + 1u;
+            return index;
+        }
+    }
+
+    return n_meters;
+}
+
+static bool poll_start(size_t index, size_t stale_index)
+{
+    MeterSlot *slot = &meters[index];
+
+    if (slot->stale && index != stale_index)
+        return false;
+
+    return sdm220_meter_poll_async(&slot->meter, slot->timeout,
+                                   on_pwr_meter_error, on_pwr_meter_ready, slot);
+}
+
+static void poll_finish(Sdm220Meter *meter)
+{
+    while (sdm220_meter_async_poll_pending(meter)) {
+        sdm220_meter_iterate(meter);
+
+        if (sdm220_meter_async_poll_pending(meter))
+            transport_wait(meter->transport, IDLE_WAIT);
+    }
+}
+
+static int refresh_priority(MeterSlot *slot)
+{
+    return serving ? arbiter_priority(&arbiter, &slot->meter) : 0;
+}
+
+/*
+ * On-demand reads queued through sdm220_meter_read_cached() jump the queue:
+ * they go out before the next meter of the cycle, not after the cycle, the
+ * meter with the most urgent request first. Each meter gets one try per call.
+ */
+static void serve_refreshes(void)
+{
+    size_t i = 0u;
+    size_t served = 0u;
+    MeterSlot *slot = NULL;
+    bool tried[MAX_METERS] = {false, };
+
+    if (serving)
+        arbiter_process(&arbiter);
+
+    for (; served < n_meters; ++served) {
+        slot = NULL;
+
+        for (i = 0u; i < n_meters; ++i) {
+            if (tried[i] || sdm220_meter_refresh_pending(&meters[i].meter) == 0u)
+                continue;
+
+            if (slot == NULL || refresh_priority(&meters[i]) > refresh_priority(slot))
+                slot = &meters[i];
+        }
+
+        if (slot == NULL)
+            break;
+
+        tried[slot - meters] = true;
+
+        if (sdm220_meter_refresh_async(&slot->meter, slot->timeout,
+                                       on_pwr_meter_error, on_pwr_meter_ready, slot))
+            poll_finish(&slot->meter);
+    }
+}
+
+/*
+ * Meters whose load is moving get extra reads of power and current between
+ * the cycle polls, the most overdue one first, for as long as the budget
+ * allows. Each read is charged the bus time it actually took.
+ */
+static void serve_bursts(void)
+{
+    size_t i = 0u;
+    mseconds_t now = 0u;
+    MeterSlot *slot = NULL;
+    Timer read_timer;
+    bool tried[MAX_METERS] = {false, };
+
+    if (!bursting)
+        return;
+
+    for (;;) {
+        now = timer_timestamp();
+        slot = NULL;
+
+        for (i = 0u; i < n_meters; ++i) {
+            if (tried[i] || !sdm220_burst_due(&meters[i].burst, now))
+                continue;
+
+            if (slot == NULL || meters[i].burst.due < slot->burst.due)
+                slot = &meters[i];
+        }
+
+        if (slot == NULL || !sdm220_burst_budget_acquire(&burst_budget))
+            break;
+
+        tried[slot - meters] = true;
+        timer_start(&read_timer);
+
+        if (sdm220_meter_poll_registers_async(&slot->meter, SDM220_BURST_MASK, slot->timeout,
+                                              on_pwr_meter_error, on_pwr_meter_ready, slot))
+            poll_finish(&slot->meter);
+
+        sdm220_burst_budget_charge(&burst_budget, timer_elapsed_us(&read_timer));
+    }
+}
+
+static void poll_sequential(size_t stale_index)
+{
+    size_t i = 0u;
+
+    /*
+     * Meters share one half-duplex bus, so they are served one at a time.
+     */
+    for (; i < n_meters; ++i) {
+        serve_refreshes();
+        serve_bursts();
+
+        if (poll_start(i, stale_index))
+            poll_finish(&meters[i].meter);
+    }
+}
+
+static void poll_concurrent(size_t stale_index)
+{
+    size_t i = 0u;
+    Sdm220Meter *waiting = NULL;
+
+    /*
+     * The transport keeps transactions apart: keep one in flight per meter
+     * so round trips to the gateway overlap. A meter done with its cycle
+     * picks up the on-demand reads queued meanwhile.
+     */
+    for (; i < n_meters; ++i)
+        poll_start(i, stale_index);
+
+    do {
+        waiting = NULL;
+
+        if (serving)
+            arbiter_process(&arbiter);
+
+        for (i = 0u; i < n_meters; ++i) {
+            sdm220_meter_iterate(&meters[i].meter);
+
+            if (!sdm220_meter_async_poll_pending(&meters[i].meter)
+                && sdm220_meter_refresh_pending(&meters[i].meter) != 0u)
+                sdm220_meter_refresh_async(&meters[i].meter, meters[i].timeout,
+                                           on_pwr_meter_error, on_pwr_meter_ready, &meters[i]);
+
+            if (waiting == NULL && sdm220_meter_async_poll_pending(&meters[i].meter))
+                waiting = &meters[i].meter;
+        }
+
+        if (waiting != NULL)
+            transport_wait(waiting->transport, IDLE_WAIT);
+    } while (waiting != NULL);
+}
+
+static void poll_all(void)
+{
+    size_t stale_index = pick_stale();
+
+    if (meters[0].meter.transport->concurrent)
+        poll_concurrent(stale_index);
+    else
+        poll_sequential(stale_index);
+}
+
+static void save_topology(void)
+{
+    if (topology_path != NULL && topology.dirty)
+        topology_save(&topology, topology_path);
+}
+
+static void on_meter_found(Discovery *discovery, uint8_t address, DiscoveryModel model,
+                           mseconds_t latency, void *user_data)
 {
-    Sdm220Meter pwr_meter = {0, };
+    ScanPort *scan_port = user_data;
+
+    printf("%s: address %u, model %s, latency %lu ms\n", scan_port->device,
+           (unsigned) address, discovery_model_name(model), (unsigned long) latency);
 
-    if (argc != 2) {
-        fprintf(stderr, "Usage: %s <tty device>\n", argv[0]);
+    if (topology_path != NULL && model != DISCOVERY_MODEL_UNKNOWN)
+        topology_update(&topology, scan_port->device, address, scan_port->baud_rate,
+                        latency, tune_timeout(latency), timer_timestamp());
+}
+
+/*
+ * Until a response arrives on any of the ports. Probe timeouts are kept by
+ * the tasks, so no wait is longer than SCAN_IDLE_WAIT.
+ */
+static void scan_wait(ScanPort *scan_ports, int n_devices)
+{
+    int i = 0;
+    struct pollfd fds[MAX_SCAN_PORTS];
+
+    for (; i < n_devices; ++i) {
+        fds[i].fd = scan_ports[i].networked ? scan_ports[i].gateway.fd : scan_ports[i].port.fd;
+        fds[i].events = POLLIN;
+        fds[i].revents = 0;
+    }
+
+    poll(fds, (nfds_t) n_devices, SCAN_IDLE_WAIT);
+}
+
+/*
+ * Every port gets its own discovery task, the ports are scanned side by side
+ * and each one only takes as long as 247 probes at its own line speed.
+ */
+static void run_scan(int n_devices, char **devices)
+{
+    int i = 0;
+    bool networked = false;
+    unsigned found = 0u;
+    mseconds_t timeout = 0u;
+    Transport *transport = NULL;
+    TaskLoop loop;
+    Timer scan_timer;
+    static ScanPort scan_ports[MAX_SCAN_PORTS];
+
+    if (n_devices > MAX_SCAN_PORTS) {
+        fprintf(stderr, "At most %d ports can be scanned at once.\n", MAX_SCAN_PORTS);
         exit(EXIT_FAILURE);
     }
 
-    rs485_init(argv[1]);
-    sdm220_meter_init(&pwr_meter, SDM220_ADDRESS);
-    if (sdm220_meter_poll_async(&pwr_meter, POLL_TIMEOUT,
-                                on_pwr_meter_error, on_pwr_meter_ready, NULL)) {
-        while (sdm220_meter_async_poll_pending(&pwr_meter)) {
-            sdm220_meter_iterate(&pwr_meter);
+    if (topology_path != NULL) {
+        topology_init(&topology, TOPOLOGY_MAX_AGE);
+        topology_load(&topology, topology_path);
+    }
+
+    task_loop_init(&loop);
+    timer_init(&scan_timer);
+
+    for (; i < n_devices; ++i) {
+        ScanPort *scan_port = &scan_ports[i];
+
+        scan_port->device = devices[i];
+        networked = modbus_tcp_gateway_init(&scan_port->gateway, devices[i]);
+        scan_port->networked = networked;
+
+        /*
+         * Behind a gateway the meters still sit on a serial line, -b is taken
+         * as its speed and the network round trip comes on top.
+         */
+        if (networked) {
+            modbus_tcp_channel_init(&scan_port->channel, &scan_port->gateway);
+            transport = &scan_port->channel.transport;
+            scan_port->baud_rate = 0u;
+            timeout = discovery_timeout(baud_rate, DISCOVERY_DEFAULT_TURNAROUND
+                                        + DISCOVERY_NETWORK_MARGIN);
+        } else {
+            rs485_init(&scan_port->port, devices[i], baud_rate);
+            transport = &scan_port->port.transport;
+            scan_port->baud_rate = baud_rate;
+            timeout = discovery_timeout(baud_rate, DISCOVERY_DEFAULT_TURNAROUND);
         }
+
+        discovery_init(&scan_port->discovery, transport, timeout, on_meter_found, scan_port);
+        task_loop_add(&loop, discovery_get_task(&scan_port->discovery));
+    }
+
+    timer_start(&scan_timer);
+
+    while (task_loop_pending(&loop)) {
+        task_loop_run_once(&loop);
+        fflush(stdout);
+
+        if (task_loop_pending(&loop))
+            scan_wait(scan_ports, n_devices);
+    }
+
+    for (i = 0; i < n_devices; ++i) {
+        found += scan_ports[i].discovery.found;
+
+        if (scan_ports[i].networked)
+            modbus_tcp_gateway_destroy(&scan_ports[i].gateway);
+    }
+
+    fprintf(stderr, "Scanned %d port(s) in %lu ms, %u device(s) found.\n", n_devices,
+            (unsigned long) timer_elapsed(&scan_timer), found);
+
+    save_topology();
+}
+
+static void print_latency(const char *label)
+{
+    size_t i = 0u;
+    Sdm220Meter *meter = NULL;
+
+    for (; i < n_meters; ++i) {
+        meter = &meters[i].meter;
+
+        if (meter->transactions == 0u)
+            continue;
+
+        fprintf(stderr, "%s latency (address %u, %lu transactions, us): "
+                "min %ld, mean %.0f, max %ld\n", label, (unsigned) meter->slave_address,
+                meter->transactions, meter->latency_min, sdm220_meter_get_latency_mean(meter),
+                meter->latency_max);
+
+        if (sdm220_meter_get_dropped_bytes(meter) != 0u)
+            fprintf(stderr, "%s resync (address %u): %lu noise bytes dropped\n", label,
+                    (unsigned) meter->slave_address, sdm220_meter_get_dropped_bytes(meter));
+    }
+}
+
+/*
+ * One cycle goes out with the system defaults first, so the effect of the
+ * tuning shows in the numbers printed on exit.
+ */
+static void tune_latency(void)
+{
+    size_t i = 0u;
+
+    /*
+     * Only there to measure, the warm-up poll reports nothing and does not
+     * count towards the exit status.
+     */
+    warming_up = true;
+    poll_all();
+    warming_up = false;
+    poll_failed = false;
+
+    print_latency("Before");
+
+    for (; i < n_meters; ++i)
+        sdm220_meter_reset_latency_stats(&meters[i].meter);
+
+    if (low_latency) {
+        if (meters[0].meter.transport == &port.transport)
+            rs485_set_low_latency(&port, device);
+        else
+            fprintf(stderr, "Low latency mode only applies to serial ports.\n");
+    }
+
+    if (rt_priority != 0) {
+        realtime_lock_memory();
+        realtime_set_priority(rt_priority);
+    }
+
+    if (rt_cpu >= 0)
+        realtime_set_cpu(rt_cpu);
+}
+
+/*
+ * The next burst read, unless the budget holds it back even longer.
+ */
+static int next_wait(void)
+{
+    size_t i = 0u;
+    mseconds_t now = timer_timestamp();
+    mseconds_t wait = ARBITER_IDLE_WAIT;
+    mseconds_t budget_wait = 0u;
+
+    if (!bursting)
+        return ARBITER_IDLE_WAIT;
+
+    for (; i < n_meters; ++i) {
+        if (sdm220_burst_wait(&meters[i].burst, now) < wait)
+            wait = sdm220_burst_wait(&meters[i].burst, now);
     }
 
-    return 0;
+    if (wait < ARBITER_IDLE_WAIT) {
+        budget_wait = sdm220_burst_budget_wait(&burst_budget);
+
+        if (budget_wait > wait)
+            wait = budget_wait < ARBITER_IDLE_WAIT ? budget_wait : ARBITER_IDLE_WAIT;
+    }
+
+    return (int) wait;
+}
+
+/*
+ * Bus owner and burst modes: sleeps on the cycle timer and the client
+ * sockets at once, so on-demand and burst reads go out as they come
+ * instead of after the next cycle. Returns true when a cycle is due.
+ */
+static bool wait_events(CycleTimer *cycle_timer, bool cyclic)
+{
+    size_t n_fds = 0u;
+    struct pollfd fds[ARBITER_MAX_CLIENTS + 2];
+
+    if (cyclic) {
+        fds[0].fd = cycle_timer->fd;
+        fds[0].events = POLLIN;
+        fds[0].revents = 0;
+        n_fds++;
+    }
+
+    if (serving)
+        n_fds += arbiter_get_pollfds(&arbiter, fds + n_fds,
+                                     sizeof(fds) / sizeof(fds[0]) - n_fds);
+
+    if (poll(fds, n_fds, next_wait()) < 0)
+        return false;
+
+    serve_refreshes();
+    serve_bursts();
+
+    return cyclic && (fds[0].revents & POLLIN) != 0 && cycle_timer_wait(cycle_timer);
+}
+
+static void run_daemon(mseconds_t interval)
+{
+    CycleTimer cycle_timer;
+    Timer save_timer;
+    struct sigaction action;
+    bool cyclic = interval != 0u;
+    bool due = false;
+
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = on_signal;
+    sigemptyset(&action.sa_mask);
+
+    /*
+     * No SA_RESTART: a signal has to interrupt the blocking timerfd read.
+     */
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+
+    if (cyclic)
+        cycle_timer_init(&cycle_timer, interval);
+
+    timer_init(&save_timer);
+
+    while (!stop_requested) {
+        if (timer_elapsed(&save_timer) >= TOPOLOGY_SAVE_INTERVAL) {
+            save_topology();
+            timer_reset(&save_timer);
+        }
+
+        due = (serving || bursting) ? wait_events(&cycle_timer, cyclic)
+                                    : cycle_timer_wait(&cycle_timer);
+        if (!due)
+            continue;
+
+        poll_all();
+        fflush(stdout);
+
+        if (exporting && !use_queue)
+            line_exporter_flush(&exporter);
+    }
+
+    if (!cyclic)
+        return;
+
+    fprintf(stderr, "Cycles: %lu, overruns: %lu, jitter (us): min %ld, mean %.0f, max %ld\n",
+            cycle_timer.cycles, cycle_timer.overruns, cycle_timer.jitter_min,
+            cycle_timer_jitter_mean(&cycle_timer), cycle_timer.jitter_max);
+
+    cycle_timer_destroy(&cycle_timer);
+}
+
+int main(int argc, char **argv)
+{
+    int opt = 0;
+    char *end = NULL;
+    mseconds_t interval = 0u;
+    unsigned long n_workers = 0u;
+    unsigned long queue_size = 0u;
+    double power_rate = 0.0;
+    double current_rate = 0.0;
+    unsigned long burst_share = 0u;
+    mseconds_t burst_max = 0u;
+    unsigned long triggers = 0u;
+    bool scan = false;
+    bool tuned = false;
+    long value = 0;
+    const char *export_url = NULL;
+    const char *arbiter_path = NULL;
+    size_t i = 0u;
+
+    while ((opt = getopt(argc, argv, "i:a:b:j:d:t:sLR:c:F:e:A:S:q:T:B:")) != -1) {
+        switch (opt) {
+        case 'L':
+            low_latency = true;
+            break;
+
+        case 'F':
+            flight_path = optarg;
+            break;
+
+        case 'e':
+            export_url = optarg;
+            break;
+
+        case 'S':
+            arbiter_path = optarg;
+            break;
+
+        case 'T':
+            power_rate = strtod(optarg, &end);
+            if (*end == ',')
+                current_rate = strtod(end + 1, &end);
+
+            if (*end != '\0' || power_rate < 0.0 || current_rate < 0.0
+                || (power_rate == 0.0 && current_rate == 0.0))
+                usage(argv[0]);
+
+            bursting = true;
+            break;
+
+        case 'B':
+            burst_share = strtoul(optarg, &end, 0);
+            if (*end != '\0' || burst_share == 0u || burst_share > 100u)
+                usage(argv[0]);
+            break;
+
+        case 'q':
+            queue_size = strtoul(optarg, &end, 0);
+            if (*end != '\0' || queue_size == 0u)
+                usage(argv[0]);
+            break;
+
+        case 'A':
+            aggregate_window = strtoul(optarg, &end, 0);
+            if (*end == ',')
+                aggregate_slide = strtoul(end + 1, &end, 0);
+
+            if (*end != '\0' || (aggregate_window == 0u && aggregate_slide == 0u))
+                usage(argv[0]);
+
+            aggregating = true;
+            break;
+
+        case 'R':
+            value = strtol(optarg, &end, 0);
+            if (*end != '\0' || value < 1 || value > 99)
+                usage(argv[0]);
+
+            rt_priority = (int) value;
+            break;
+
+        case 'c':
+            value = strtol(optarg, &end, 0);
+            if (*end != '\0' || value < 0)
+                usage(argv[0]);
+
+            rt_cpu = (int) value;
+            break;
+
+        case 's':
+            scan = true;
+            break;
+
+        case 'i':
+            interval = strtoul(optarg, &end, 0);
+            if (*end != '\0' || interval == 0u)
+                usage(argv[0]);
+            break;
+
+        case 'a':
+            add_meters(argv[0], optarg);
+            break;
+
+        case 'd':
+            add_deadbands(argv[0], optarg);
+            break;
+
+        case 'b':
+            baud_rate = (unsigned) strtoul(optarg, &end, 0);
+            if (*end != '\0' || baud_rate == 0u)
+                usage(argv[0]);
+            break;
+
+        case 't':
+            topology_path = optarg;
+            break;
+
+        case 'j':
+            n_workers = strtoul(optarg, &end, 0);
+            if (*end != '\0' || n_workers == 0u || n_workers > WORKER_POOL_MAX_WORKERS)
+                usage(argv[0]);
+            break;
+
+        default:
+            usage(argv[0]);
+        }
+    }
+
+    /*
+     * kill -USR1 writes out what the flight recorder holds at any time.
+     */
+    if (flight_path != NULL)
+        install_dump_signal();
+
+    if (scan) {
+        if (optind == argc)
+            usage(argv[0]);
+
+        if (baud_rate == 0u)
+            baud_rate = RS485_DEFAULT_BAUD_RATE;
+
+        run_scan(argc - optind, argv + optind);
+        return 0;
+    }
+
+    if (optind != argc - 1)
+        usage(argv[0]);
+
+    device = argv[optind];
+
+    if (aggregating && export_url == NULL)
+        usage(argv[0]);
+
+    if (burst_share != 0u && !bursting)
+        usage(argv[0]);
+
+    /*
+     * Bursts happen between the polls of a running daemon.
+     */
+    if (bursting && interval == 0u && arbiter_path == NULL)
+        usage(argv[0]);
+
+    if (export_url != NULL) {
+        if (!line_exporter_init(&exporter, export_url, EXPORT_MEASUREMENT, device)) {
+            fprintf(stderr, "Unable to export to %s.\n", export_url);
+            exit(EXIT_FAILURE);
+        }
+
+        exporting = true;
+    }
+
+    if (topology_path != NULL)
+        load_topology();
+
+    if (n_meters == 0u)
+        meters[n_meters++].address = SDM220_ADDRESS;
+
+    if (baud_rate == 0u)
+        baud_rate = RS485_DEFAULT_BAUD_RATE;
+
+    open_meters();
+
+    /*
+     * A burst decays back to the normal cadence. Its reads may take up to
+     * the given share of bus time, the bucket holds one cycle's worth.
+     */
+    if (bursting) {
+        burst_max = interval != 0u ? interval : BURST_MAX_INTERVAL;
+
+        if (burst_share == 0u)
+            burst_share = BURST_DEFAULT_BUDGET;
+
+        for (i = 0u; i < n_meters; ++i)
+            sdm220_burst_init(&meters[i].burst, power_rate, current_rate,
+                              BURST_MIN_INTERVAL, burst_max);
+
+        sdm220_burst_budget_init(&burst_budget, (double) burst_share / 100.0,
+                                 (long) (burst_max * burst_share * 10u));
+    }
+
+    /*
+     * As the one process on the bus, other tools read through us.
+     */
+    if (arbiter_path != NULL) {
+        if (!arbiter_init(&arbiter, arbiter_path)) {
+            fprintf(stderr, "Unable to listen on %s.\n", arbiter_path);
+            exit(EXIT_FAILURE);
+        }
+
+        for (i = 0u; i < n_meters; ++i)
+            arbiter_add_meter(&arbiter, &meters[i].meter);
+
+        arbiter_set_fleet(&arbiter, &fleet);
+        serving = true;
+    }
+
+    /*
+     * With workers the polling thread only snapshots values, formatting and
+     * output happen off the bus path.
+     */
+    if (n_workers != 0u) {
+        if (!worker_pool_init(&pool, n_workers, false)) {
+            fprintf(stderr, "Unable to start %lu workers.\n", n_workers);
+            exit(EXIT_FAILURE);
+        }
+
+        use_pool = true;
+    }
+
+    /*
+     * With a queue the ready callback only copies the values into it, the
+     * consumer thread does the rest at its own pace. Nothing it does (a slow
+     * collector, a blocked stdout) holds up the next request on the bus.
+     */
+    if (queue_size != 0u) {
+        if (!sample_queue_init(&samples, queue_size)
+            || pthread_create(&consumer, NULL, consumer_main, NULL) != 0) {
+            fprintf(stderr, "Unable to start the sample consumer.\n");
+            exit(EXIT_FAILURE);
+        }
+
+        use_queue = true;
+    }
+
+    /*
+     * Worker threads are already running and keep the default policy, only
+     * the polling thread goes real-time.
+     */
+    tuned = low_latency || rt_priority != 0 || rt_cpu >= 0;
+    if (tuned)
+        tune_latency();
+
+    if (interval != 0u || serving)
+        run_daemon(interval);
+    else
+        poll_all();
+
+    if (use_queue) {
+        sample_queue_close(&samples);
+        pthread_join(consumer, NULL);
+
+        fprintf(stderr, "Samples: %lu queued, %lu batches, %lu overflows, "
+                "high water %zu of %zu\n", (unsigned long) samples.pushed,
+                (unsigned long) samples.batches, (unsigned long) samples.overflows,
+                samples.high_water, samples.capacity);
+
+        sample_queue_destroy(&samples);
+    }
+
+    if (bursting) {
+        for (i = 0u; i < n_meters; ++i)
+            triggers += meters[i].burst.triggers;
+
+        fprintf(stderr, "Bursts: %lu triggers, %lu reads, %lu deferred by budget, "
+                "%.0f ms of bus time\n", triggers, burst_budget.reads, burst_budget.denied,
+                burst_budget.spent / 1000.0);
+    }
+
+    if (serving) {
+        fprintf(stderr, "Requests: %lu, cache hits: %lu, merged: %lu, bus reads queued: %lu\n",
+                arbiter.n_requests, arbiter.cache_hits, arbiter.merged, arbiter.queued);
+        arbiter_destroy(&arbiter);
+    }
+
+    save_topology();
+
+    if (exporting) {
+        for (i = 0u; i < n_meters; ++i)
+            sdm220_aggregator_flush(&meters[i].aggregator);
+
+        line_exporter_flush(&exporter);
+        line_exporter_destroy(&exporter);
+
+        if (exporter.dropped != 0u || exporter.send_errors != 0u)
+            fprintf(stderr, "Export: %lu sent, %lu dropped, %lu send errors\n",
+                    exporter.sent, exporter.dropped, exporter.send_errors);
+    }
+
+    if (tuned || interval != 0u)
+        print_latency(tuned ? "After" : "Transaction");
+
+    if (use_pool) {
+        worker_pool_destroy(&pool);
+
+        if (pool.dropped != 0u)
+            fprintf(stderr, "Reports dropped: %lu\n", (unsigned long) pool.dropped);
+    }
+
+    sdm220_fleet_destroy(&fleet);
+
+    return (interval == 0u && poll_failed) ? EXIT_FAILURE : 0;
 }
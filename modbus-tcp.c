@@ -0,0 +1,557 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <poll.h>
+#include <netdb.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+#include "timer.h"
+#include "modbus-tcp.h"
+
+#define MBAP_PREFIX "tcp://"
+#define RTU_PREFIX  "rtu+tcp://"
+
+static void gateway_close(ModbusTcpGateway *self)
+{
+    size_t i = 0u;
+
+    if (self->fd >= 0)
+        close(self->fd);
+
+    self->fd = -1;
+    self->rx_size = 0u;
+
+    /*
+     * Whatever was in flight is lost with the connection; the owners of
+     * these transactions will see their own timeout.
+     */
+    for (; i < self->n_channels; ++i)
+        self->channels[i]->pending = false;
+}
+
+static bool wait_fd(int fd, short events, int timeout)
+{
+    int ret = 0;
+    struct pollfd fds = {0, };
+
+    fds.fd = fd;
+    fds.events = events;
+
+    ret = poll(&fds, 1, timeout);
+    if (ret < 0 && errno != EINTR) {
+        perror("poll");
+        exit(EXIT_FAILURE);
+    }
+
+    return ret == 1;
+}
+
+static bool try_connect(ModbusTcpGateway *self, struct addrinfo *ai)
+{
+    int fd = -1;
+    int opt = 1;
+    int error = 0;
+    socklen_t error_size = sizeof(error);
+
+    fd = socket(ai->ai_family, ai->ai_socktype | SOCK_NONBLOCK | SOCK_CLOEXEC, ai->ai_protocol);
+    if (fd < 0)
+        return false;
+
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &opt, sizeof(opt));
+
+    if (connect(fd, ai->ai_addr, ai->ai_addrlen) != 0) {
+        if (errno != EINPROGRESS
+            || !wait_fd(fd, POLLOUT, MODBUS_TCP_CONNECT_TIMEOUT)
+            || getsockopt(fd, SOL_SOCKET, SO_ERROR, &error, &error_size) != 0
+            || error != 0) {
+
+            close(fd);
+            return false;
+        }
+    }
+
+    self->fd = fd;
+    return true;
+}
+
+static bool gateway_connect(ModbusTcpGateway *self)
+{
+    int ret = 0;
+    struct addrinfo hints;
+    struct addrinfo *result = NULL;
+    struct addrinfo *ai = NULL;
+
+    if (self->fd >= 0)
+        return true;
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+
+    ret = getaddrinfo(self->host, self->port, &hints, &result);
+    if (ret != 0) {
+        fprintf(stderr, "getaddrinfo: %s: %s\n", self->host, gai_strerror(ret));
+        return false;
+    }
+
+    for (ai = result; ai != NULL; ai = ai->ai_next) {
+        if (try_connect(self, ai))
+            break;
+    }
+
+    freeaddrinfo(result);
+
+    if (self->fd < 0) {
+        fprintf(stderr, "Unable to connect to %s:%s.\n", self->host, self->port);
+        return false;
+    }
+
+    self->rx_size = 0u;
+    return true;
+}
+
+static bool gateway_send_once(ModbusTcpGateway *self, uint8_t *buf, size_t buf_size)
+{
+    ssize_t ret = 0;
+    size_t sent = 0u;
+
+    while (sent < buf_size) {
+        ret = send(self->fd, buf + sent, buf_size - sent, MSG_NOSIGNAL | MSG_DONTWAIT);
+        if (ret < 0) {
+            if (errno == EINTR)
+                continue;
+
+            if ((errno == EAGAIN || errno == EWOULDBLOCK)
+                && wait_fd(self->fd, POLLOUT, MODBUS_TCP_CONNECT_TIMEOUT))
+                continue;
+
+            return false;
+        }
+
+        sent += (size_t) ret;
+    }
+
+    return true;
+}
+
+static bool gateway_send(ModbusTcpGateway *self, uint8_t *buf, size_t buf_size)
+{
+    /*
+     * A connection the gateway dropped while idle is only noticed on send:
+     * reconnect once and retry.
+     */
+    if (gateway_connect(self) && gateway_send_once(self, buf, buf_size))
+        return true;
+
+    gateway_close(self);
+
+    return gateway_connect(self) && gateway_send_once(self, buf, buf_size);
+}
+
+static void channel_deliver(ModbusTcpChannel *channel, const uint8_t *frame, size_t frame_size,
+                            bool append_crc)
+{
+    uint16_t crc = 0u;
+
+    memcpy(channel->rx, frame, frame_size);
+    channel->rx_size = frame_size;
+    channel->rx_head = 0u;
+
+    if (append_crc) {
+        crc = modbus_crc16(frame, frame_size);
+
+        channel->rx[channel->rx_size++] = (uint8_t) (crc & 0xff);
+        channel->rx[channel->rx_size++] = (uint8_t) ((crc >> 8) & 0xff);
+    }
+
+    channel->pending = false;
+}
+
+static inline void consume(ModbusTcpGateway *self, size_t size)
+{
+    memmove(self->rx, self->rx + size, self->rx_size - size);
+    self->rx_size -= size;
+}
+
+static void parse_mbap(ModbusTcpGateway *self)
+{
+    size_t i = 0u;
+    size_t length = 0u;
+    uint16_t transaction_id = 0u;
+    ModbusTcpChannel *channel = NULL;
+
+    while (self->rx_size >= MODBUS_TCP_MBAP_HEADER_SIZE + 1u) {
+        length = ((size_t) self->rx[4] << 8) | self->rx[5];
+
+        if (self->rx[2] != 0u || self->rx[3] != 0u
+            || length < 2u || length > MODBUS_RTU_MAX_FRAME_SIZE - 2u) {
+            /*
+             * Not MBAP framing: there is no way to find the next header in
+             * a TCP stream, start over on a fresh connection.
+             */
+            gateway_close(self);
+            return;
+        }
+
+        if (self->rx_size < MODBUS_TCP_MBAP_HEADER_SIZE + length)
+            return;
+
+        transaction_id = (uint16_t) (((unsigned) self->rx[0] << 8) | self->rx[1]);
+
+        for (i = 0u; i < self->n_channels; ++i) {
+            channel = self->channels[i];
+
+            if (channel->pending && channel->transaction_id == transaction_id) {
+                channel_deliver(channel, self->rx + MODBUS_TCP_MBAP_HEADER_SIZE, length, true);
+                break;
+            }
+        }
+
+        consume(self, MODBUS_TCP_MBAP_HEADER_SIZE + length);
+    }
+}
+
+/*
+ * Raw RTU has no transaction id, a response has to look like the answer
+ * to what the channel asked: same slave, same function (or its exception)
+ * and, for reads, the byte count of the quantity requested.
+ */
+static bool channel_expects(ModbusTcpChannel *channel, const uint8_t *frame)
+{
+    if (!channel->pending || channel->slave_address != frame[0])
+        return false;
+
+    if ((frame[1] & ~MODBUS_EXCEPTION_FLAG) != channel->function)
+        return false;
+
+    return (frame[1] & MODBUS_EXCEPTION_FLAG) != 0u || channel->byte_count == 0u
+        || frame[2] == channel->byte_count;
+}
+
+static void parse_rtu(ModbusTcpGateway *self)
+{
+    size_t i = 0u;
+    size_t size = 0u;
+    ModbusTcpChannel *channel = NULL;
+
+    while (self->rx_size >= 3u) {
+        size = modbus_rtu_response_size(self->rx);
+
+        if (size == 0u || size > MODBUS_RTU_MAX_FRAME_SIZE) {
+            consume(self, 1u);
+            continue;
+        }
+
+        if (self->rx_size < size)
+            return;
+
+        if (!modbus_crc16_check(self->rx, size)) {
+            consume(self, 1u);
+            continue;
+        }
+
+        for (i = 0u; i < self->n_channels; ++i) {
+            channel = self->channels[i];
+
+            if (channel_expects(channel, self->rx)) {
+                channel_deliver(channel, self->rx, size, false);
+                break;
+            }
+        }
+
+        consume(self, size);
+    }
+}
+
+static void gateway_pump(ModbusTcpGateway *self)
+{
+    ssize_t ret = 0;
+
+    while (self->fd >= 0 && self->rx_size < MODBUS_TCP_BUFFER_SIZE) {
+        ret = recv(self->fd, self->rx + self->rx_size,
+                   MODBUS_TCP_BUFFER_SIZE - self->rx_size, MSG_DONTWAIT);
+
+        if (ret < 0) {
+            if (errno == EINTR)
+                continue;
+
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+                gateway_close(self);
+
+            break;
+        }
+
+        if (ret == 0) {
+            gateway_close(self);
+            break;
+        }
+
+        self->rx_size += (size_t) ret;
+
+        if (self->framing == MODBUS_TCP_FRAMING_MBAP)
+            parse_mbap(self);
+        else
+            parse_rtu(self);
+    }
+}
+
+static bool gateway_drain(ModbusTcpGateway *self)
+{
+    ssize_t ret = 0;
+    bool drained = false;
+
+    while (self->fd >= 0) {
+        ret = recv(self->fd, self->rx, MODBUS_TCP_BUFFER_SIZE, MSG_DONTWAIT);
+
+        if (ret < 0) {
+            if (errno == EINTR)
+                continue;
+
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+                gateway_close(self);
+
+            break;
+        }
+
+        if (ret == 0) {
+            gateway_close(self);
+            break;
+        }
+
+        drained = true;
+    }
+
+    self->rx_size = 0u;
+    return drained;
+}
+
+/*
+ * Only one RTU transaction is on the line at a time. Whatever is buffered
+ * or already waiting in the socket when the next request goes out answers
+ * one that timed out, and would otherwise pass for the new answer (every
+ * register of a meter is read with an identical looking response).
+ *
+ * After a timeout the answer may still be on its way: the line has to stay
+ * quiet for MODBUS_TCP_RTU_SETTLE_TIME first. Answers later than that are
+ * indistinguishable and cannot be told apart.
+ */
+static void gateway_flush(ModbusTcpGateway *self)
+{
+    size_t i = 0u;
+    bool timed_out = false;
+    Timer settle_timer;
+
+    for (; i < self->n_channels; ++i) {
+        timed_out |= self->channels[i]->pending;
+        self->channels[i]->pending = false;
+    }
+
+    gateway_drain(self);
+
+    if (!timed_out)
+        return;
+
+    timer_init(&settle_timer);
+
+    while (self->fd >= 0 && timer_elapsed(&settle_timer) < MODBUS_TCP_RTU_SETTLE_MAX
+           && wait_fd(self->fd, POLLIN, MODBUS_TCP_RTU_SETTLE_TIME)) {
+        gateway_drain(self);
+    }
+}
+
+static bool channel_poll(Transport *transport)
+{
+    ModbusTcpChannel *self = (ModbusTcpChannel *) transport;
+
+    if (self->rx_head < self->rx_size)
+        return true;
+
+    gateway_pump(self->gateway);
+
+    return self->rx_head < self->rx_size;
+}
+
+static bool channel_read_byte(Transport *transport, uint8_t *byte)
+{
+    ModbusTcpChannel *self = (ModbusTcpChannel *) transport;
+
+    if (!channel_poll(transport))
+        return false;
+
+    *byte = self->rx[self->rx_head++];
+    return true;
+}
+
+static void channel_write(Transport *transport, uint8_t *buf, size_t buf_size)
+{
+    size_t size = 0u;
+    uint8_t frame[MODBUS_TCP_MBAP_HEADER_SIZE + MODBUS_RTU_MAX_FRAME_SIZE];
+    ModbusTcpChannel *self = (ModbusTcpChannel *) transport;
+    ModbusTcpGateway *gateway = self->gateway;
+
+    if (buf_size < 4u || buf_size > MODBUS_RTU_MAX_FRAME_SIZE)
+        return;
+
+    self->rx_head = 0u;
+    self->rx_size = 0u;
+    self->slave_address = buf[0];
+    self->function = buf[1];
+    self->byte_count = 0u;
+
+    if ((buf[1] == MODBUS_READ_HOLDING_REGISTERS || buf[1] == MODBUS_READ_INPUT_REGISTERS)
+        && buf_size >= 6u)
+        self->byte_count = (uint8_t) (2u * (((unsigned) buf[4] << 8) | buf[5]));
+
+    if (gateway->framing == MODBUS_TCP_FRAMING_MBAP) {
+        /*
+         * Unit id and PDU go as is, the RTU CRC is replaced by TCP's own.
+         */
+        size = buf_size - 2u;
+
+        self->transaction_id = gateway->next_transaction_id++;
+
+        frame[0] = (uint8_t) (self->transaction_id >> 8);
+        frame[1] = (uint8_t) (self->transaction_id & 0xff);
+        frame[2] = 0u;
+        frame[3] = 0u;
+        frame[4] = (uint8_t) (size >> 8);
+        frame[5] = (uint8_t) (size & 0xff);
+
+        memcpy(frame + MODBUS_TCP_MBAP_HEADER_SIZE, buf, size);
+        size += MODBUS_TCP_MBAP_HEADER_SIZE;
+    } else {
+        gateway_flush(gateway);
+
+        memcpy(frame, buf, buf_size);
+        size = buf_size;
+    }
+
+    self->pending = gateway_send(gateway, frame, size);
+}
+
+static bool channel_wait(Transport *transport, int timeout)
+{
+    ModbusTcpChannel *self = (ModbusTcpChannel *) transport;
+
+    if (channel_poll(transport))
+        return true;
+
+    if (self->gateway->fd < 0) {
+        poll(NULL, 0, timeout);
+        return false;
+    }
+
+    if (wait_fd(self->gateway->fd, POLLIN, timeout))
+        return channel_poll(transport);
+
+    return false;
+}
+
+static bool parse_url(ModbusTcpGateway *self, const char *url)
+{
+    const char *host = NULL;
+    const char *end = NULL;
+    const char *port = NULL;
+    size_t host_size = 0u;
+
+    if (strncmp(url, MBAP_PREFIX, strlen(MBAP_PREFIX)) == 0) {
+        self->framing = MODBUS_TCP_FRAMING_MBAP;
+        host = url + strlen(MBAP_PREFIX);
+    } else if (strncmp(url, RTU_PREFIX, strlen(RTU_PREFIX)) == 0) {
+        self->framing = MODBUS_TCP_FRAMING_RTU;
+        host = url + strlen(RTU_PREFIX);
+    } else
+        return false;
+
+    if (host[0] == '[') {
+        /*
+         * [v6 address]:port
+         */
+        end = strchr(++host, ']');
+        if (end == NULL)
+            return false;
+
+        port = (end[1] == ':') ? end + 2 : NULL;
+    } else {
+        end = strrchr(host, ':');
+        port = (end != NULL) ? end + 1 : NULL;
+
+        if (end == NULL)
+            end = host + strlen(host);
+    }
+
+    host_size = (size_t) (end - host);
+    if (host_size == 0u || host_size >= sizeof(self->host))
+        return false;
+
+    memcpy(self->host, host, host_size);
+    self->host[host_size] = '\0';
+
+    if (port == NULL || port[0] == '\0')
+        port = MODBUS_TCP_DEFAULT_PORT;
+
+    if (strlen(port) >= sizeof(self->port))
+        return false;
+
+    strcpy(self->port, port);
+    return true;
+}
+
+bool modbus_tcp_gateway_init(ModbusTcpGateway *self, const char *url)
+{
+    memset(self, 0, sizeof(ModbusTcpGateway));
+
+    self->fd = -1;
+
+    if (!parse_url(self, url))
+        return false;
+
+    self->next_transaction_id = 1u;
+    self->bus = transport_next_bus();
+    self->n_channels = 0u;
+    self->rx_size = 0u;
+
+    /*
+     * Connect eagerly so a wrong address shows up at startup; failures
+     * later on are retried on the next request.
+     */
+    gateway_connect(self);
+    return true;
+}
+
+void modbus_tcp_gateway_destroy(ModbusTcpGateway *self)
+{
+    gateway_close(self);
+    self->n_channels = 0u;
+}
+
+void modbus_tcp_channel_init(ModbusTcpChannel *self, ModbusTcpGateway *gateway)
+{
+    if (gateway->n_channels == MODBUS_TCP_MAX_CHANNELS) {
+        fprintf(stderr, "Too many channels on %s:%s.\n", gateway->host, gateway->port);
+        exit(EXIT_FAILURE);
+    }
+
+    self->transport.poll = channel_poll;
+    self->transport.read_byte = channel_read_byte;
+    self->transport.write = channel_write;
+    self->transport.wait = channel_wait;
+    self->transport.concurrent = gateway->framing == MODBUS_TCP_FRAMING_MBAP;
+    self->transport.bus = gateway->bus;
+
+    self->gateway = gateway;
+    self->transaction_id = 0u;
+    self->slave_address = 0u;
+    self->function = 0u;
+    self->byte_count = 0u;
+    self->pending = false;
+    self->rx_head = 0u;
+    self->rx_size = 0u;
+
+    gateway->channels[gateway->n_channels++] = self;
+}
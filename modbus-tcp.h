@@ -0,0 +1,97 @@
+/**
+ * @file modbus-tcp.h
+ * @author Sereda Anton <sereda-anton@yandex.ru>
+ *
+ * Copyright (c) 2017 Sereda Anton
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+#ifndef MODBUS_TCP_H
+#define MODBUS_TCP_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "modbus.h"
+#include "transport.h"
+
+#define MODBUS_TCP_DEFAULT_PORT     "502"
+#define MODBUS_TCP_MAX_CHANNELS     247
+#define MODBUS_TCP_MBAP_HEADER_SIZE 6
+#define MODBUS_TCP_BUFFER_SIZE      (2 * (MODBUS_RTU_MAX_FRAME_SIZE + MODBUS_TCP_MBAP_HEADER_SIZE + 4))
+#define MODBUS_TCP_CONNECT_TIMEOUT  3000
+#define MODBUS_TCP_RTU_SETTLE_TIME  200     /* quiet line after a timeout, ms */
+#define MODBUS_TCP_RTU_SETTLE_MAX   1000
+
+typedef struct _ModbusTcpGateway ModbusTcpGateway;
+typedef struct _ModbusTcpChannel ModbusTcpChannel;
+typedef enum _ModbusTcpFraming ModbusTcpFraming;
+
+enum _ModbusTcpFraming {
+    MODBUS_TCP_FRAMING_MBAP = 1,    /* tcp://host[:port]     */
+    MODBUS_TCP_FRAMING_RTU          /* rtu+tcp://host[:port] */
+};
+
+/*
+ * One persistent connection to an Ethernet to RS485 gateway, shared by all
+ * channels behind it. Responses are demultiplexed to channels by MBAP
+ * transaction id (so every channel may have a transaction outstanding at
+ * the same time) or, for raw RTU over TCP, by slave address, function and
+ * byte count of the request.
+ */
+struct _ModbusTcpGateway {
+    int fd;
+    ModbusTcpFraming framing;
+    char host[256];
+    char port[16];
+    uint16_t next_transaction_id;
+    uint16_t bus;
+    ModbusTcpChannel *channels[MODBUS_TCP_MAX_CHANNELS];
+    size_t n_channels;
+    uint8_t rx[MODBUS_TCP_BUFFER_SIZE];
+    size_t rx_size;
+};
+
+/*
+ * Transport of one slave behind a gateway. Requests and responses are
+ * plain RTU frames on this side, MBAP wrapping (and CRC stripping and
+ * recomputation) is done here.
+ */
+struct _ModbusTcpChannel {
+    Transport transport;
+    ModbusTcpGateway *gateway;
+    uint16_t transaction_id;
+    uint8_t slave_address;
+    uint8_t function;
+    uint8_t byte_count;     /* of the expected read response, 0 for others */
+    bool pending;
+    uint8_t rx[MODBUS_RTU_MAX_FRAME_SIZE + 4];
+    size_t rx_head;
+    size_t rx_size;
+};
+
+bool modbus_tcp_gateway_init(ModbusTcpGateway *self, const char *url);
+void modbus_tcp_gateway_destroy(ModbusTcpGateway *self);
+
+void modbus_tcp_channel_init(ModbusTcpChannel *self, ModbusTcpGateway *gateway);
+
+#endif /* MODBUS_TCP_H */
@@ -0,0 +1,73 @@
+#include "modbus.h"
+
+uint16_t modbus_crc16(const uint8_t *data, size_t data_size)
+{
+    size_t i = 0u;
+    size_t j = 0u;
+    uint16_t crc = 0xffffu;
+
+    for (; i < data_size; ++i) {
+        crc ^= data[i];
+        for (j = 0u; j < 8u; ++j) {
+            if ((crc & 1u) != 0u) {
+                crc >>= 1;
+                crc ^= 0xa001u;
+            } else
+                crc >>= 1;
+        }
+    }
+
+    return crc;
+}
+
+bool modbus_crc16_check(const uint8_t *frame, size_t frame_size)
+{
+    uint16_t crc = 0u;
+
+    if (frame_size < 3u)
+        return false;
+
+    crc = modbus_crc16(frame, frame_size - 2u);
+
+    return frame[frame_size-2] == (uint8_t) (crc & 0xff)
+        && frame[frame_size-1] == (uint8_t) ((crc >> 8) & 0xff);
+}
+
+size_t modbus_build_read_request(uint8_t *frame, uint8_t slave_address, uint8_t function,
+                                 uint16_t start_address, uint16_t quantity)
+{
+    uint16_t crc = 0u;
+
+    frame[0] = slave_address;
+    frame[1] = function;
+    frame[2] = (uint8_t) (start_address >> 8);
+    frame[3] = (uint8_t) (start_address & 0xff);
+    frame[4] = (uint8_t) (quantity >> 8);
+    frame[5] = (uint8_t) (quantity & 0xff);
+
+    crc = modbus_crc16(frame, 6u);
+
+    frame[6] = (uint8_t) (crc & 0xff);
+    frame[7] = (uint8_t) ((crc >> 8) & 0xff);
+
+    return MODBUS_RTU_REQUEST_SIZE;
+}
+
+size_t modbus_rtu_response_size(const uint8_t *header)
+{
+    if ((header[1] & MODBUS_EXCEPTION_FLAG) != 0u)
+        return 5u;
+
+    switch (header[1]) {
+    case MODBUS_READ_HOLDING_REGISTERS:
+    case MODBUS_READ_INPUT_REGISTERS:
+        return (size_t) header[2] + 5u;
+
+    case MODBUS_WRITE_SINGLE_REGISTER:
+    case MODBUS_WRITE_MULTIPLE_REGISTERS:
+        return 8u;
+
+    default:
+        return 0u;
+    }
+}
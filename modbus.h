@@ -0,0 +1,56 @@
+/**
+ * @file modbus.h
+ * @author Sereda Anton <sereda-anton@yandex.ru>
+ *
+ * Copyright (c) 2017 Sereda Anton
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+#ifndef MODBUS_H
+#define MODBUS_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#define MODBUS_READ_HOLDING_REGISTERS   3
+#define MODBUS_READ_INPUT_REGISTERS     4
+#define MODBUS_WRITE_SINGLE_REGISTER    6
+#define MODBUS_WRITE_MULTIPLE_REGISTERS 16
+#define MODBUS_EXCEPTION_FLAG           0x80
+
+#define MODBUS_RTU_MAX_FRAME_SIZE       256
+
+uint16_t modbus_crc16(const uint8_t *data, size_t data_size);
+bool modbus_crc16_check(const uint8_t *frame, size_t frame_size);
+
+#define MODBUS_RTU_REQUEST_SIZE         8
+
+size_t modbus_build_read_request(uint8_t *frame, uint8_t slave_address, uint8_t function,
+                                 uint16_t start_address, uint16_t quantity);
+
+/*
+ * Expected size of an RTU response given at least its first three bytes,
+ * 0 when the function code is not one we know how to frame.
+ */
+size_t modbus_rtu_response_size(const uint8_t *header);
+
+#endif /* MODBUS_H */
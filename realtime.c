@@ -0,0 +1,62 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <string.h>
+#include <sched.h>
+#include <pthread.h>
+#include <sys/mman.h>
+
+#include "realtime.h"
+
+bool realtime_set_priority(int priority)
+{
+    int ret = 0;
+    struct sched_param param;
+
+    memset(&param, 0, sizeof(param));
+    param.sched_priority = priority;
+
+    ret = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+    if (ret != 0) {
+        fprintf(stderr, "Unable to switch to SCHED_FIFO %d: %s.\n", priority, strerror(ret));
+        return false;
+    }
+
+    return true;
+}
+
+bool realtime_set_cpu(int cpu)
+{
+    int ret = 0;
+    cpu_set_t set;
+
+    if (cpu < 0 || cpu >= CPU_SETSIZE) {
+        fprintf(stderr, "Bad CPU number: %d.\n", cpu);
+        return false;
+    }
+
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+
+    ret = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+    if (ret != 0) {
+        fprintf(stderr, "Unable to pin thread to CPU %d: %s.\n", cpu, strerror(ret));
+        return false;
+    }
+
+    return true;
+}
+
+/*
+ * A page fault in the middle of a transaction costs more than the latency
+ * we are trying to save.
+ */
+bool realtime_lock_memory(void)
+{
+    if (mlockall(MCL_CURRENT | MCL_FUTURE) != 0) {
+        perror("mlockall");
+        return false;
+    }
+
+    return true;
+}
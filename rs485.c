@@ -1,16 +1,31 @@
 #include <stdio.h>
+#include <string.h>
+#include <limits.h>
 #include <sys/stat.h>
+#include <sys/ioctl.h>
+#include <linux/serial.h>
 #include <fcntl.h>
 #include <termios.h>
 #include <unistd.h>
 #include <stdlib.h>
 #include <poll.h>
+#include <errno.h>
 
 #include "rs485.h"
 
-#define BAUD_RATE B9600
-
-static int tty_dev = -1;
+static const struct {
+    unsigned baud_rate;
+    speed_t speed;
+} speeds[] = {
+    {1200,   B1200},
+    {2400,   B2400},
+    {4800,   B4800},
+    {9600,   B9600},
+    {19200,  B19200},
+    {38400,  B38400},
+    {57600,  B57600},
+    {115200, B115200}
+};
 
 static inline int raw_tty_open(const char *path, speed_t baud_rate)
 {
@@ -53,31 +68,145 @@ static inline bool file_exist_and_character_device(const char *path)
     return S_ISCHR(stat_buf.st_mode);
 }
 
-void rs485_init(const char *path)
+static bool poll_impl(Transport *transport)
+{
+    return rs485_available((Rs485Port *) transport);
+}
+
+static bool read_byte_impl(Transport *transport, uint8_t *byte)
+{
+    return rs485_read_byte_nonblocking((Rs485Port *) transport, byte);
+}
+
+static void write_impl(Transport *transport, uint8_t *buf, size_t buf_size)
 {
+    rs485_write((Rs485Port *) transport, buf, buf_size);
+}
+
+static bool wait_impl(Transport *transport, int timeout)
+{
+    return rs485_wait((Rs485Port *) transport, timeout);
+}
+
+static inline bool baud_rate_to_speed(unsigned baud_rate, speed_t *speed)
+{
+    size_t i = 0u;
+
+    for (; i < sizeof(speeds) / sizeof(speeds[0]); ++i) {
+        if (speeds[i].baud_rate == baud_rate) {
+            *speed = speeds[i].speed;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void rs485_init(Rs485Port *self, const char *path, unsigned baud_rate)
+{
+    speed_t speed = B9600;
+
     if (!file_exist_and_character_device(path)) {
         fprintf(stderr, "Bad device path: %s.\n", path);
         exit(EXIT_FAILURE);
     }
 
-    tty_dev = raw_tty_open(path, BAUD_RATE);
+    if (!baud_rate_to_speed(baud_rate, &speed)) {
+        fprintf(stderr, "Unsupported baud rate: %u.\n", baud_rate);
+        exit(EXIT_FAILURE);
+    }
+
+    self->fd = raw_tty_open(path, speed);
+    self->baud_rate = baud_rate;
 
-    if (tty_dev < 0) {
+    if (self->fd < 0) {
         perror("raw_tty_open");
         exit(EXIT_FAILURE);
     }
+
+    self->transport.poll = poll_impl;
+    self->transport.read_byte = read_byte_impl;
+    self->transport.write = write_impl;
+    self->transport.wait = wait_impl;
+    self->transport.concurrent = false;
+    self->transport.bus = transport_next_bus();
+}
+
+static bool set_async_low_latency(int fd)
+{
+    struct serial_struct serial;
+
+    if (ioctl(fd, TIOCGSERIAL, &serial) < 0)
+        return false;
+
+    serial.flags |= ASYNC_LOW_LATENCY;
+
+    return ioctl(fd, TIOCSSERIAL, &serial) == 0;
 }
 
-bool rs485_available(void)
+/*
+ * USB serial drivers (ftdi_sio) hold received bytes back for up to
+ * latency_timer ms before they hand them to the host.
+ */
+static bool set_latency_timer(const char *path, unsigned value)
+{
+    bool done = false;
+    FILE *file = NULL;
+    const char *name = NULL;
+    char resolved[PATH_MAX];
+    char sysfs_path[PATH_MAX + 64];
+
+    if (realpath(path, resolved) == NULL)
+        return false;
+
+    name = strrchr(resolved, '/');
+    name = name != NULL ? name + 1 : resolved;
+
+    snprintf(sysfs_path, sizeof(sysfs_path), "/sys/class/tty/%s/device/latency_timer", name);
+
+    file = fopen(sysfs_path, "w");
+    if (file == NULL)
+        return false;
+
+    done = fprintf(file, "%u", value) > 0;
+    done = fclose(file) == 0 && done;
+
+    return done;
+}
+
+/*
+ * Opt-in, best effort: plain UARTs have no latency timer and some drivers
+ * refuse TIOCSSERIAL, whatever could not be applied is reported and skipped.
+ */
+bool rs485_set_low_latency(Rs485Port *self, const char *path)
+{
+    bool async_low_latency = false;
+    bool latency_timer = false;
+
+    async_low_latency = set_async_low_latency(self->fd);
+    if (!async_low_latency)
+        fprintf(stderr, "%s: ASYNC_LOW_LATENCY not supported.\n", path);
+
+    latency_timer = set_latency_timer(path, RS485_LOW_LATENCY_TIMER);
+    if (!latency_timer)
+        fprintf(stderr, "%s: no USB serial latency timer to tune.\n", path);
+
+    return async_low_latency || latency_timer;
+}
+
+bool rs485_wait(Rs485Port *self, int timeout)
 {
     int ret = 0;
     struct pollfd fds = {0, };
 
-    fds.fd = tty_dev;
+    fds.fd = self->fd;
     fds.events = POLLIN;
 
-    ret = poll(&fds, 1, 0);
+    ret = poll(&fds, 1, timeout);
     if (ret < 0) {
+        if (errno == EINTR)
+            return false;
+
         perror("poll");
         exit(EXIT_FAILURE);
     }
@@ -85,14 +214,19 @@ bool rs485_available(void)
     return ret == 1;
 }
 
-bool rs485_read_byte_nonblocking(uint8_t *result)
+bool rs485_available(Rs485Port *self)
+{
+    return rs485_wait(self, 0);
+}
+
+bool rs485_read_byte_nonblocking(Rs485Port *self, uint8_t *result)
 {
     int ret = 0;
 
-    if (!rs485_available())
+    if (!rs485_available(self))
         return false;
 
-    ret = read(tty_dev, result, 1);
+    ret = read(self->fd, result, 1);
     if (ret < 0) {
         perror("read");
         exit(EXIT_FAILURE);
@@ -101,29 +235,28 @@ bool rs485_read_byte_nonblocking(uint8_t *result)
     return ret == 1;
 }
 
-bool rs485_read_byte(uint8_t *result)
+bool rs485_read_byte(Rs485Port *self, uint8_t *result)
 {
-    while (!rs485_available()) {}
+    while (!rs485_available(self)) {}
 
-    return rs485_read_byte_nonblocking(result);
+    return rs485_read_byte_nonblocking(self, result);
 }
 
-void rs485_write_byte(uint8_t byte)
+void rs485_write_byte(Rs485Port *self, uint8_t byte)
 {
     int ret = 0;
 
-    ret = write(tty_dev, &byte, 1);
+    ret = write(self->fd, &byte, 1);
     if (ret < 0) {
         perror("write");
         exit(EXIT_FAILURE);
     }
 }
 
-void rs485_write(uint8_t *buf, size_t buf_size)
+void rs485_write(Rs485Port *self, uint8_t *buf, size_t buf_size)
 {
     size_t i = 0u;
 
     for (; i < buf_size; ++i)
-        rs485_write_byte(buf[i]);
+        rs485_write_byte(self, buf[i]);
 }
-
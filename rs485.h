@@ -31,11 +31,26 @@
 #include <stdint.h>
 #include <stdbool.h>
 
-void rs485_init(const char *path);
-bool rs485_available(void);
-bool rs485_read_byte_nonblocking(uint8_t *result);
-bool rs485_read_byte(uint8_t *result);
-void rs485_write_byte(uint8_t byte);
-void rs485_write(uint8_t *buf, size_t buf_size);
+#include "transport.h"
+
+#define RS485_DEFAULT_BAUD_RATE 9600
+#define RS485_LOW_LATENCY_TIMER 1   /* ms, USB serial adapters (FTDI default 16) */
+
+typedef struct _Rs485Port Rs485Port;
+
+struct _Rs485Port {
+    Transport transport;
+    int fd;
+    unsigned baud_rate;
+};
+
+void rs485_init(Rs485Port *self, const char *path, unsigned baud_rate);
+bool rs485_set_low_latency(Rs485Port *self, const char *path);
+bool rs485_available(Rs485Port *self);
+bool rs485_wait(Rs485Port *self, int timeout);
+bool rs485_read_byte_nonblocking(Rs485Port *self, uint8_t *result);
+bool rs485_read_byte(Rs485Port *self, uint8_t *result);
+void rs485_write_byte(Rs485Port *self, uint8_t byte);
+void rs485_write(Rs485Port *self, uint8_t *buf, size_t buf_size);
 
 #endif /* RS485_H */
@@ -0,0 +1,203 @@
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "sample-queue.h"
+
+static size_t round_up_pow2(size_t value)
+{
+    size_t size = 1u;
+
+    while (size < value)
+        size <<= 1;
+
+    return size;
+}
+
+bool sample_queue_init(SampleQueue *self, size_t capacity)
+{
+    void *samples = NULL;
+
+    if (capacity == 0u)
+        return false;
+
+    capacity = round_up_pow2(capacity);
+
+    if (posix_memalign(&samples, SAMPLE_QUEUE_CACHE_LINE, capacity * sizeof(Sample)) != 0)
+        return false;
+
+    /*
+     * Touched once here, so the first samples do not page fault on the bus
+     * thread (which may run with locked memory and real-time priority).
+     */
+    memset(samples, 0, capacity * sizeof(Sample));
+
+    if (sem_init(&self->signal, 0, 0u) != 0) {
+        free(samples);
+        return false;
+    }
+
+    self->samples = samples;
+    self->capacity = capacity;
+
+    atomic_init(&self->tail, 0u);
+    self->head_cache = 0u;
+    atomic_init(&self->pushed, 0u);
+    atomic_init(&self->overflows, 0u);
+
+    atomic_init(&self->head, 0u);
+    self->tail_cache = 0u;
+    atomic_init(&self->popped, 0u);
+    atomic_init(&self->batches, 0u);
+    self->high_water = 0u;
+
+    atomic_init(&self->waiting, false);
+    atomic_init(&self->closed, false);
+
+    return true;
+}
+
+void sample_queue_destroy(SampleQueue *self)
+{
+    sem_destroy(&self->signal);
+    free(self->samples);
+
+    self->samples = NULL;
+    self->capacity = 0u;
+}
+
+Sample *sample_queue_reserve(SampleQueue *self)
+{
+    size_t tail = atomic_load_explicit(&self->tail, memory_order_relaxed);
+
+    if (tail - self->head_cache == self->capacity) {
+        self->head_cache = atomic_load_explicit(&self->head, memory_order_acquire);
+
+        if (tail - self->head_cache == self->capacity) {
+            atomic_fetch_add_explicit(&self->overflows, 1u, memory_order_relaxed);
+            return NULL;
+        }
+    }
+
+    return &self->samples[tail & (self->capacity - 1u)];
+}
+
+void sample_queue_commit(SampleQueue *self)
+{
+    size_t tail = atomic_load_explicit(&self->tail, memory_order_relaxed) + 1u;
+
+    atomic_fetch_add_explicit(&self->pushed, 1u, memory_order_relaxed);
+
+    /*
+     * Sequentially consistent against the consumer going to sleep: either
+     * it sees the new tail or we see it waiting.
+     */
+    atomic_store(&self->tail, tail);
+
+    if (atomic_load(&self->waiting) && atomic_exchange(&self->waiting, false))
+        sem_post(&self->signal);
+}
+
+bool sample_queue_push_meter(SampleQueue *self, Sdm220Meter *meter, Sdm220RegisterMask mask,
+                             mseconds_t timestamp, uint64_t timestamp_ns)
+{
+    Sample *sample = sample_queue_reserve(self);
+
+    if (sample == NULL)
+        return false;
+
+    sample->slave_address = meter->slave_address;
+    sample->mask = mask;
+    sample->timestamp = timestamp;
+    sample->timestamp_ns = timestamp_ns;
+    memcpy(sample->values, meter->value_table, sizeof(sample->values));
+    memcpy(sample->timestamps, meter->timestamp_table, sizeof(sample->timestamps));
+
+    sample_queue_commit(self);
+    return true;
+}
+
+void sample_queue_close(SampleQueue *self)
+{
+    atomic_store(&self->closed, true);
+    sem_post(&self->signal);
+}
+
+size_t sample_queue_peek(SampleQueue *self, Sample **samples, size_t max)
+{
+    size_t head = atomic_load_explicit(&self->head, memory_order_relaxed);
+    size_t index = head & (self->capacity - 1u);
+    size_t n = 0u;
+
+    if (self->tail_cache == head) {
+        self->tail_cache = atomic_load_explicit(&self->tail, memory_order_acquire);
+
+        if (self->tail_cache - head > self->high_water)
+            self->high_water = self->tail_cache - head;
+    }
+
+    /*
+     * Only the run up to the end of the array, the rest comes with the
+     * next batch.
+     */
+    n = self->tail_cache - head;
+    if (n > self->capacity - index)
+        n = self->capacity - index;
+
+    if (n > max)
+        n = max;
+
+    *samples = &self->samples[index];
+    return n;
+}
+
+void sample_queue_release(SampleQueue *self, size_t n)
+{
+    size_t head = atomic_load_explicit(&self->head, memory_order_relaxed);
+
+    if (n == 0u)
+        return;
+
+    atomic_fetch_add_explicit(&self->popped, n, memory_order_relaxed);
+    atomic_fetch_add_explicit(&self->batches, 1u, memory_order_relaxed);
+    atomic_store_explicit(&self->head, head + n, memory_order_release);
+}
+
+bool sample_queue_wait(SampleQueue *self, mseconds_t timeout)
+{
+    struct timespec deadline;
+    size_t head = atomic_load_explicit(&self->head, memory_order_relaxed);
+
+    if (atomic_load_explicit(&self->tail, memory_order_acquire) != head)
+        return true;
+
+    /*
+     * On the monotonic clock, a wall clock step neither cuts the wait short
+     * nor stretches it.
+     */
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    deadline.tv_sec += (time_t) (timeout / 1000u);
+    deadline.tv_nsec += (long) (timeout % 1000u) * 1000000l;
+
+    if (deadline.tv_nsec >= 1000000000l) {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000l;
+    }
+
+    atomic_store(&self->waiting, true);
+
+    if (atomic_load(&self->tail) == head && !sample_queue_closed(self))
+        while (sem_clockwait(&self->signal, CLOCK_MONOTONIC, &deadline) != 0
+               && errno == EINTR) {}
+
+    atomic_store(&self->waiting, false);
+
+    return atomic_load_explicit(&self->tail, memory_order_acquire) != head;
+}
+
+bool sample_queue_closed(SampleQueue *self)
+{
+    return atomic_load(&self->closed);
+}
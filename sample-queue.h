@@ -0,0 +1,119 @@
+/**
+ * @file sample-queue.h
+ * @author Sereda Anton <sereda-anton@yandex.ru>
+ *
+ * Copyright (c) 2017 Sereda Anton
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+#ifndef SAMPLE_QUEUE_H
+#define SAMPLE_QUEUE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <semaphore.h>
+
+#include "timer.h"
+#include "sdm220.h"
+
+#define SAMPLE_QUEUE_CACHE_LINE     64
+#define SAMPLE_QUEUE_DEFAULT_SIZE   1024
+
+typedef struct _Sample Sample;
+typedef struct _SampleQueue SampleQueue;
+
+/*
+ * One completed read, by value. Records are padded to whole cache lines so
+ * the producer filling one never shares a line with the consumer reading
+ * the one before.
+ */
+struct _Sample {
+    uint8_t slave_address;
+    Sdm220RegisterMask mask;    /* registers this read carried */
+    mseconds_t timestamp;
+    uint64_t timestamp_ns;
+    double values[SDM220_VALUE_TABLE_SIZE];
+    mseconds_t timestamps[SDM220_VALUE_TABLE_SIZE];    /* when each value was read */
+} __attribute__((aligned (SAMPLE_QUEUE_CACHE_LINE)));
+
+/*
+ * Lock-free ring between exactly one producer (the thread owning the bus)
+ * and one consumer. All records are allocated up front, pushing a sample is
+ * a copy and two index updates.
+ *
+ * Each index sits on its own cache line and only its owner writes it; each
+ * side keeps a private copy of the other one and only rereads the shared
+ * index when that copy says the ring is full (empty).
+ *
+ * The producer never waits: a sample that finds the ring full is dropped
+ * and counted in 'overflows'. The consumer is only woken up through the
+ * semaphore when it went to sleep on an empty ring.
+ */
+struct _SampleQueue {
+    /*
+     * Producer side.
+     */
+    atomic_size_t tail __attribute__((aligned (SAMPLE_QUEUE_CACHE_LINE)));
+    size_t head_cache;
+    atomic_ulong pushed;
+    atomic_ulong overflows;
+
+    /*
+     * Consumer side.
+     */
+    atomic_size_t head __attribute__((aligned (SAMPLE_QUEUE_CACHE_LINE)));
+    size_t tail_cache;
+    atomic_ulong popped;
+    atomic_ulong batches;
+    size_t high_water;  /* most samples seen waiting at once */
+
+    atomic_bool waiting __attribute__((aligned (SAMPLE_QUEUE_CACHE_LINE)));
+    atomic_bool closed;
+    sem_t signal;
+
+    Sample *samples __attribute__((aligned (SAMPLE_QUEUE_CACHE_LINE)));
+    size_t capacity;    /* power of two */
+};
+
+bool sample_queue_init(SampleQueue *self, size_t capacity);
+void sample_queue_destroy(SampleQueue *self);
+
+/*
+ * Producer. A reserved record becomes visible to the consumer on commit.
+ */
+Sample *sample_queue_reserve(SampleQueue *self);
+void sample_queue_commit(SampleQueue *self);
+bool sample_queue_push_meter(SampleQueue *self, Sdm220Meter *meter, Sdm220RegisterMask mask,
+                             mseconds_t timestamp, uint64_t timestamp_ns);
+void sample_queue_close(SampleQueue *self);
+
+/*
+ * Consumer. sample_queue_peek() hands out up to max records in place, they
+ * stay valid until sample_queue_release() gives them back.
+ */
+size_t sample_queue_peek(SampleQueue *self, Sample **samples, size_t max);
+void sample_queue_release(SampleQueue *self, size_t n);
+bool sample_queue_wait(SampleQueue *self, mseconds_t timeout);
+bool sample_queue_closed(SampleQueue *self);
+
+#endif /* SAMPLE_QUEUE_H */
@@ -4,10 +4,17 @@
 #include <unistd.h>
 #include <math.h>
 
-#include "rs485.h"
+#include "modbus.h"
 #include "sdm220.h"
+#include "flight-recorder.h"
 
-#define READ_INPUT_REGISTERS 4
+#define READ_INPUT_REGISTERS MODBUS_READ_INPUT_REGISTERS
+#define RESPONSE_DATA_SIZE   4u      /* one float, two registers */
+#define MAX_RUN_SIZE         6       /* floats per request, fits SDM220_BUFFER_SIZE */
+#define MAX_EXCEPTION_CODE   0x0bu
+
+#define meter_from_istream(istream) \
+    ((Sdm220Meter *) ((char *) (istream) - offsetof(Sdm220Meter, istream)))
 
 typedef struct {
     uint8_t hi_byte;
@@ -25,68 +32,45 @@ typedef struct __attribute__((aligned (1))) {
     uint8_t crc_hi;
 } QueryReadInputRegisters;
 
-typedef enum {
-    INPUT_REG_VOLTAGE = 0,
-    INPUT_REG_CURRENT,
-    INPUT_REG_ACTIVE_POWER,
-    INPUT_REG_APPARENT_POWER,
-    INPUT_REG_REACTIVE_POWER,
-    INPUT_REG_POWER_FACTOR,
-    INPUT_REG_PHASE_ANGLE,
-    INPUT_REG_FREQUENCY,
-    INPUT_REG_IMPORT_ACTIVE_ENERGY,
-    INPUT_REG_EXPORT_ACTIVE_ENERGY,
-    INPUT_REG_IMPORT_REACTIVE_ENERGY,
-    INPUT_REG_EXPORT_REACTIVE_ENERGY,
-    INPUT_REG_TOTAL_ACTIVE_ENERGY,
-    INPUT_REG_TOTAL_REACTIVE_ENERGY,
-
-    N_INPUT_REGISTERS
-} InputRegister;
-
-enum {
-    STATE_INVALID = -1,
-    STATE_BEGIN_QUERY = 0,
-    STATE_READ_MODBUS_HEADER,
-    STATE_READ_MODBUS_BODY
-};
+typedef Sdm220Register InputRegister;
 
-static InputRegisterAddress input_registers[N_INPUT_REGISTERS] = {
-    [INPUT_REG_VOLTAGE]                 = {0,   0},
-    [INPUT_REG_CURRENT]                 = {0,   0x6},
-    [INPUT_REG_ACTIVE_POWER]            = {0,   0xc},
-    [INPUT_REG_APPARENT_POWER]          = {0,   0x12},
-    [INPUT_REG_REACTIVE_POWER]          = {0,   0x18},
-    [INPUT_REG_POWER_FACTOR]            = {0,   0x1e},
-    [INPUT_REG_PHASE_ANGLE]             = {0,   0x24},
-    [INPUT_REG_FREQUENCY]               = {0,   0x46},
-    [INPUT_REG_IMPORT_ACTIVE_ENERGY]    = {0,   0x48},
-    [INPUT_REG_EXPORT_ACTIVE_ENERGY]    = {0,   0x4a},
-    [INPUT_REG_IMPORT_REACTIVE_ENERGY]  = {0,   0x4c},
-    [INPUT_REG_EXPORT_REACTIVE_ENERGY]  = {0,   0x4e},
-    [INPUT_REG_TOTAL_ACTIVE_ENERGY]     = {1,   0x56},
-    [INPUT_REG_TOTAL_REACTIVE_ENERGY]   = {1,   0x58}
-};
+#define N_INPUT_REGISTERS SDM220_N_REGISTERS
 
-uint16_t crc16(uint8_t *data, size_t data_size)
-{
-    size_t i = 0u;
-    size_t j = 0u;
-    uint16_t crc = 0xffffu;
+static int poll_task(Task *task);
 
-    for (; i < data_size; ++i) {
-        crc ^= data[i];
-        for (j = 0u; j < 8u; ++j) {
-            if ((crc & 1u) != 0u) {
-                crc >>= 1;
-                crc ^= 0xa001u;
-            } else
-                crc >>= 1;
-        }
-    }
+static InputRegisterAddress input_registers[N_INPUT_REGISTERS] = {
+    [SDM220_REGISTER_VOLTAGE]                  = {0,   0},
+    [SDM220_REGISTER_CURRENT]                  = {0,   0x6},
+    [SDM220_REGISTER_ACTIVE_POWER]             = {0,   0xc},
+    [SDM220_REGISTER_APPARENT_POWER]           = {0,   0x12},
+    [SDM220_REGISTER_REACTIVE_POWER]           = {0,   0x18},
+    [SDM220_REGISTER_POWER_FACTOR]             = {0,   0x1e},
+    [SDM220_REGISTER_PHASE_ANGLE]              = {0,   0x24},
+    [SDM220_REGISTER_FREQUENCY]                = {0,   0x46},
+    [SDM220_REGISTER_IMPORT_ACTIVE_ENERGY]     = {0,   0x48},
+    [SDM220_REGISTER_EXPORT_ACTIVE_ENERGY]     = {0,   0x4a},
+    [SDM220_REGISTER_IMPORT_REACTIVE_ENERGY]   = {0,   0x4c},
+    [SDM220_REGISTER_EXPORT_REACTIVE_ENERGY]   = {0,   0x4e},
+    [SDM220_REGISTER_TOTAL_ACTIVE_ENERGY]      = {1,   0x56},
+    [SDM220_REGISTER_TOTAL_REACTIVE_ENERGY]    = {1,   0x58}
+};
 
-    return crc;
-}
+static const char *register_names[N_INPUT_REGISTERS] = {
+    [SDM220_REGISTER_VOLTAGE]                  = "voltage",
+    [SDM220_REGISTER_CURRENT]                  = "current",
+    [SDM220_REGISTER_ACTIVE_POWER]             = "active_power",
+    [SDM220_REGISTER_APPARENT_POWER]           = "apparent_power",
+    [SDM220_REGISTER_REACTIVE_POWER]           = "reactive_power",
+    [SDM220_REGISTER_POWER_FACTOR]             = "power_factor",
+    [SDM220_REGISTER_PHASE_ANGLE]              = "phase_angle",
+    [SDM220_REGISTER_FREQUENCY]                = "frequency",
+    [SDM220_REGISTER_IMPORT_ACTIVE_ENERGY]     = "import_active_energy",
+    [SDM220_REGISTER_EXPORT_ACTIVE_ENERGY]     = "export_active_energy",
+    [SDM220_REGISTER_IMPORT_REACTIVE_ENERGY]   = "import_reactive_energy",
+    [SDM220_REGISTER_EXPORT_REACTIVE_ENERGY]   = "export_reactive_energy",
+    [SDM220_REGISTER_TOTAL_ACTIVE_ENERGY]      = "total_active_energy",
+    [SDM220_REGISTER_TOTAL_REACTIVE_ENERGY]    = "total_reactive_energy"
+};
 
 static inline double parse_ieee754_be(uint8_t *bytes)
 {
@@ -105,152 +89,325 @@ static inline double parse_ieee754_be(uint8_t *bytes)
 
 static bool read_byte_impl(InputStream *istream, uint8_t *byte)
 {
-    return rs485_read_byte_nonblocking(byte);
+    return transport_read_byte(meter_from_istream(istream)->transport, byte);
 }
 
 static bool poll_impl(InputStream *istream)
 {
-    return rs485_available();
+    return transport_poll(meter_from_istream(istream)->transport);
 }
 
-void sdm220_meter_init(Sdm220Meter *self, uint8_t addr)
+void sdm220_meter_init(Sdm220Meter *self, Transport *transport, uint8_t addr)
 {
     input_stream_init(&self->istream, read_byte_impl, poll_impl);
+    task_init(&self->task, poll_task, self);
+    timer_init(&self->latency_timer);
 
     memset(self->buffer, 0, SDM220_BUFFER_SIZE);
     memset(self->value_table, 0, SDM220_VALUE_TABLE_SIZE * sizeof(double));
+    memset(self->timestamp_table, 0, SDM220_VALUE_TABLE_SIZE * sizeof(mseconds_t));
+    memset(self->read_time_table, 0, SDM220_VALUE_TABLE_SIZE * sizeof(mseconds_t));
 
     self->slave_address = addr;
+    self->transport = transport;
     self->buffer_size = 0u;
     self->data_size = 0u;
-    self->state = STATE_INVALID;
     self->next_input_register = -1;
+    self->run_size = 1;
+    self->poll_mask = 0u;
+    self->refresh_mask = 0u;
     self->error_flag = false;
     self->timeout = 0u;
+    self->latency = 0u;
+    self->dropped_bytes = 0u;
+    self->flight_state = FLIGHT_STATE_IDLE;
+    sdm220_meter_reset_latency_stats(self);
     self->error_callback = NULL;
     self->ready_callback = NULL;
     self->user_data = NULL;
 }
 
-static inline void read_input_register_begin(Sdm220Meter *self, InputRegister reg)
+static inline unsigned register_address(InputRegister reg)
+{
+    return (unsigned) input_registers[reg].hi_byte << 8 | input_registers[reg].low_byte;
+}
+
+/*
+ * Registers polled together that also sit next to each other in the meter
+ * (frequency and the four energy counters, the two totals) are read with a
+ * single request. Gaps are never read across.
+ */
+static int run_length(Sdm220Meter *self, InputRegister first)
+{
+    int n = 1;
+
+    while ((int) first + n < N_INPUT_REGISTERS && n < MAX_RUN_SIZE
+           && (self->poll_mask & SDM220_REGISTER_MASK(first + n)) != 0u
+           && register_address(first + n) == register_address(first) + 2u * (unsigned) n)
+        n++;
+
+    return n;
+}
+
+static inline void build_query(Sdm220Meter *self, InputRegister reg, int n, uint8_t *query_buf)
 {
     uint16_t crc = 0u;
-    uint8_t *query_buf = NULL;
-    QueryReadInputRegisters query = {0, };
+    QueryReadInputRegisters *query = NULL;
+
+    query = (QueryReadInputRegisters *) query_buf;
 
-    query_buf = (uint8_t *) &query;
+    query->slave_address = self->slave_address;
+    query->function = READ_INPUT_REGISTERS;
+    query->start_address_hi = input_registers[reg].hi_byte;
+    query->start_address_low = input_registers[reg].low_byte;
+    query->quantity_hi = 0;
+    query->quantity_low = (uint8_t) (2 * n);
 
-    query.slave_address = self->slave_address;
-    query.function = READ_INPUT_REGISTERS;
-    query.start_address_hi = input_registers[reg].hi_byte;
-    query.start_address_low = input_registers[reg].low_byte;
-    query.quantity_hi = 0;
-    query.quantity_low = 2;
+    crc = modbus_crc16(query_buf, 6);
 
-    crc = crc16(query_buf, 6);
+    query->crc_low = (uint8_t) (crc & 0xff);
+    query->crc_hi = (uint8_t) ((crc >> 8) & 0xff);
+}
 
-    query.crc_low = (uint8_t) (crc & 0xff);
-    query.crc_hi = (uint8_t) ((crc >> 8) & 0xff);
+static inline void set_state(Sdm220Meter *self, FlightState state)
+{
+    if (self->flight_state == state)
+        return;
 
-    rs485_write(query_buf, sizeof(query) / sizeof(uint8_t));
+    self->flight_state = (uint8_t) state;
+    flight_recorder_record(FLIGHT_EVENT_STATE, self->slave_address, (uint32_t) state, NULL, 0u);
 }
 
-static void on_data_ready(InputStream *istream, RuntimeError *error,
-                          uint8_t *buf, size_t size, void *user_data)
+static void notify_error(Sdm220Meter *self, Sdm220MeterErrorCode code)
 {
-    uint16_t crc = 0u;
-    size_t resp_size = 0u;
-    Sdm220Meter *self = NULL;
-
-    self = user_data;
-
-    switch (self->state) {
-    case STATE_READ_MODBUS_HEADER:
-        if (size == 3 && self->buffer[2] != 0) {
-            self->data_size = (size_t) (self->buffer[2] + 2u);
-            self->state = STATE_READ_MODBUS_BODY;
-        } else {
-            /*
-             * TODO: Handle Error: Bad response
-             */
-        }
-        break;
+    Sdm220MeterError error = {0, };
+    Sdm220MeterErrorCallback callback = NULL;
+    void *user_data = NULL;
 
-    case STATE_READ_MODBUS_BODY:
-        if (size == self->data_size) {
-            resp_size = self->data_size + 3u;
+    callback = self->error_callback;
+    user_data = self->user_data;
 
-            crc = crc16(self->buffer, resp_size - 2u);
-            if (self->buffer[resp_size-2] == (uint8_t) (crc & 0xff)
-                && self->buffer[resp_size-1] == (uint8_t) ((crc >> 8) & 0xff)) {
+    self->error_flag = true;
+    self->error_callback = NULL;
+    self->ready_callback = NULL;
+    set_state(self, FLIGHT_STATE_IDLE);
 
-                self->value_table[self->next_input_register] = parse_ieee754_be(buf);
-            } else {
-                /*
-                 * TODO: Handle error: Bad checksum
-                 */
-            }
+    /*
+     * Whoever asked for the registers this poll did not get to hears about
+     * the error through the callback. Left pending, a meter that is gone
+     * would be retried for them on every pass.
+     */
+    self->refresh_mask &= ~self->poll_mask;
+
+    error.code = code;
+    error.exception_code = code == SDM220_METER_ERROR_CODE_EXCEPTION ? self->buffer[2] : 0u;
+
+    flight_recorder_record(FLIGHT_EVENT_ERROR, self->slave_address, (uint32_t) code,
+                           &error.exception_code, 1u);
+
+    if (callback == NULL)
+        return;
+
+    callback(self, &error, user_data);
+}
+
+static void notify_ready(Sdm220Meter *self)
+{
+    Sdm220MeterReadyCallback callback = NULL;
+    void *user_data = NULL;
+
+    callback = self->ready_callback;
+    user_data = self->user_data;
+
+    self->error_callback = NULL;
+    self->ready_callback = NULL;
+    set_state(self, FLIGHT_STATE_IDLE);
 
-            self->next_input_register++;
-            self->state = STATE_BEGIN_QUERY;
+    if (callback != NULL)
+        callback(self, user_data);
+}
+
+static bool check_read(Sdm220Meter *self, size_t expected_size)
+{
+    Task *task = &self->task;
+
+    if (task_failed(task)) {
+        if (task->error.code == INPUT_STREAM_ERROR_OUT_OF_MEMORY)
+            notify_error(self, SDM220_METER_ERROR_CODE_BUFFER_OVERFLOW);
+        else
+            notify_error(self, SDM220_METER_ERROR_CODE_TIMEOUT);
+
+        return false;
+    }
+
+    if (task->io_size != expected_size) {
+        notify_error(self, SDM220_METER_ERROR_CODE_BAD_RESPONSE);
+        return false;
+    }
+
+    return true;
+}
+
+/*
+ * A frame candidate at the start of the buffer: our slave address, the
+ * function we asked for and the byte count we asked for, or an exception
+ * to it. Only the CRC confirms it.
+ */
+static bool header_plausible(Sdm220Meter *self)
+{
+    if (self->buffer[0] != self->slave_address)
+        return false;
+
+    if (self->buffer[1] == READ_INPUT_REGISTERS)
+        return self->buffer[2] == RESPONSE_DATA_SIZE * (unsigned) self->run_size;
+
+    if (self->buffer[1] == (READ_INPUT_REGISTERS | MODBUS_EXCEPTION_FLAG))
+        return self->buffer[2] != 0u && self->buffer[2] <= MAX_EXCEPTION_CODE;
+
+    return false;
+}
 
-            if (self->next_input_register == N_INPUT_REGISTERS) {
-                if (!self->error_flag) {
-                    self->ready_callback(self, self->user_data);
+/*
+ * Slide the window one byte: the candidate at the start of the buffer was
+ * line noise (or the tail of somebody else's frame).
+ */
+static inline void drop_byte(Sdm220Meter *self)
+{
+    memmove(self->buffer, self->buffer + 1u, self->buffer_size - 1u);
+
+    self->buffer_size--;
+    self->data_size = 3u;
+    self->dropped_bytes++;
+}
+
+/*
+ * The timeout covers the whole transaction, however many bytes of garbage
+ * have to be skipped on the way.
+ */
+static inline mseconds_t time_left(Sdm220Meter *self)
+{
+    mseconds_t elapsed = timer_elapsed(&self->latency_timer);
+
+    return elapsed >= self->timeout ? 0u : self->timeout - elapsed;
+}
+
+static inline void update_latency(Sdm220Meter *self, long usec)
+{
+    mseconds_t sample = (mseconds_t) (usec / 1000l);
+
+    if (self->transactions == 0u || usec < self->latency_min)
+        self->latency_min = usec;
+
+    if (self->transactions == 0u || usec > self->latency_max)
+        self->latency_max = usec;
+
+    self->latency_sum += (double) usec;
+    self->transactions++;
+
+    /*
+     * Exponential moving average over roughly the last eight transactions.
+     */
+    if (self->latency == 0u)
+        self->latency = sample;
+    else
+        self->latency = (self->latency * 7u + sample) / 8u;
+}
+
+static int poll_task(Task *task)
+{
+    int i = 0;
+    int reg = 0;
+    Sdm220Meter *self = task->user_data;
+    uint8_t query[sizeof(QueryReadInputRegisters)];
+
+    TASK_BEGIN(task);
+
+    for (self->next_input_register = SDM220_REGISTER_VOLTAGE;
+         self->next_input_register < N_INPUT_REGISTERS;
+         self->next_input_register++) {
+
+        if ((self->poll_mask & SDM220_REGISTER_MASK(self->next_input_register)) == 0u)
+            continue;
+
+        self->run_size = run_length(self, self->next_input_register);
+        build_query(self, self->next_input_register, self->run_size, query);
+        timer_start(&self->latency_timer);
+        set_state(self, FLIGHT_STATE_WAIT_HEADER);
+        await_write(task, self->transport, query, sizeof(query));
+
+        /*
+         * Resynchronizing receive: buffer_size bytes are held, data_size are
+         * needed (a header, then the whole frame it announces). Anything that
+         * fails the header or the CRC check costs one byte, not the cycle.
+         */
+        self->buffer_size = 0u;
+        self->data_size = 3u;
+
+        for (;;) {
+            if (self->buffer_size < self->data_size) {
+                if (time_left(self) == 0u) {
+                    notify_error(self, SDM220_METER_ERROR_CODE_TIMEOUT);
+                    TASK_EXIT(task);
                 }
 
-                self->error_callback = NULL;
-                self->ready_callback = NULL;
+                await_read(task, &self->istream, self->buffer + self->buffer_size,
+                           self->data_size - self->buffer_size, time_left(self));
+                if (!check_read(self, self->data_size - self->buffer_size))
+                    TASK_EXIT(task);
+
+                self->buffer_size = self->data_size;
+                continue;
             }
-        } else {
-            /*
-             * TODO: Handle Error: Bad response
-             */
+
+            if (!header_plausible(self)) {
+                set_state(self, FLIGHT_STATE_RESYNC);
+                drop_byte(self);
+                continue;
+            }
+
+            self->data_size = modbus_rtu_response_size(self->buffer);
+            if (self->buffer_size < self->data_size) {
+                set_state(self, FLIGHT_STATE_WAIT_FRAME);
+                continue;
+            }
+
+            if (modbus_crc16_check(self->buffer, self->data_size))
+                break;
+
+            set_state(self, FLIGHT_STATE_RESYNC);
+            drop_byte(self);
+        }
+
+        if ((self->buffer[1] & MODBUS_EXCEPTION_FLAG) != 0u) {
+            notify_error(self, SDM220_METER_ERROR_CODE_EXCEPTION);
+            TASK_EXIT(task);
         }
-        break;
 
-    default:
-        break;
+        update_latency(self, timer_elapsed_us(&self->latency_timer));
+
+        for (i = 0; i < self->run_size; ++i) {
+            reg = self->next_input_register + i;
+
+            self->value_table[reg] = parse_ieee754_be(self->buffer + 3u + RESPONSE_DATA_SIZE * i);
+            self->timestamp_table[reg] = timer_timestamp();
+            self->read_time_table[reg] = timer_monotonic();
+            self->refresh_mask &= ~SDM220_REGISTER_MASK(reg);
+        }
+
+        self->next_input_register += self->run_size - 1;
     }
+
+    notify_ready(self);
+
+    TASK_END(task);
 }
 
 void sdm220_meter_iterate(Sdm220Meter *self)
 {
-    InputStream *istream = NULL;
-
     if (!sdm220_meter_async_poll_pending(self))
         return;
 
-    istream = &self->istream;
-
-    if (input_stream_pending(istream)) {
-        input_stream_run(istream);
-        return;
-    }
-
-    switch (self->state) {
-    case STATE_BEGIN_QUERY:
-        read_input_register_begin(self, self->next_input_register);
-        self->state = STATE_READ_MODBUS_HEADER;
-        break;
-
-    case STATE_READ_MODBUS_HEADER:
-        input_stream_read_async(istream, self->timeout,
-                                self->buffer,
-                                3,
-                                on_data_ready, self);
-        break;
-
-    case STATE_READ_MODBUS_BODY:
-        input_stream_read_async(istream, self->timeout,
-                                self->buffer + 3,
-                                self->data_size,
-                                on_data_ready, self);
-        break;
-
-    default:
-        break;
-    }
+    task_run(&self->task);
 }
 
 bool sdm220_meter_async_poll_pending(Sdm220Meter *self)
@@ -264,11 +421,26 @@ bool sdm220_meter_poll_async(Sdm220Meter *self,
 			                 Sdm220MeterReadyCallback ready_callback,
 			                 void *user_data)
 {
-    if (sdm220_meter_async_poll_pending(self))
+    return sdm220_meter_poll_registers_async(self, SDM220_REGISTER_MASK_ALL, timeout,
+                                             error_callback, ready_callback, user_data);
+}
+
+bool sdm220_meter_poll_registers_async(Sdm220Meter *self,
+                                       Sdm220RegisterMask mask,
+                                       unsigned timeout,
+                                       Sdm220MeterErrorCallback error_callback,
+                                       Sdm220MeterReadyCallback ready_callback,
+                                       void *user_data)
+{
+    if (sdm220_meter_async_poll_pending(self) || (mask & SDM220_REGISTER_MASK_ALL) == 0u)
         return false;
 
-    self->next_input_register = INPUT_REG_VOLTAGE;
-    self->state = STATE_BEGIN_QUERY;
+    task_init(&self->task, poll_task, self);
+
+    self->next_input_register = SDM220_REGISTER_VOLTAGE;
+    self->poll_mask = mask & SDM220_REGISTER_MASK_ALL;
+    flight_recorder_record(FLIGHT_EVENT_POLL, self->slave_address, self->poll_mask, NULL, 0u);
+    self->error_flag = false;
 
     self->timeout = timeout;
     self->error_callback = error_callback;
@@ -278,73 +450,201 @@ bool sdm220_meter_poll_async(Sdm220Meter *self,
     return true;
 }
 
+/*
+ * True when the poll in flight is still going to read the register.
+ */
+static inline bool read_in_flight(Sdm220Meter *self, Sdm220Register reg)
+{
+    return sdm220_meter_async_poll_pending(self)
+        && (self->poll_mask & SDM220_REGISTER_MASK(reg)) != 0u
+        && (int) reg >= self->next_input_register;
+}
+
+Sdm220ValueStatus sdm220_meter_read_cached(Sdm220Meter *self, Sdm220Register reg,
+                                           mseconds_t max_age, double *value)
+{
+    mseconds_t read_time = 0u;
+
+    if ((int) reg < 0 || reg >= SDM220_N_REGISTERS) {
+        *value = 0.0;
+        return SDM220_VALUE_MISSING;
+    }
+
+    *value = self->value_table[reg];
+    read_time = self->read_time_table[reg];
+
+    /*
+     * The age is measured on the monotonic clock: a wall clock step would
+     * make every value look fresh, or all of them expired.
+     */
+    if (read_time != 0u && timer_monotonic() - read_time <= max_age)
+        return SDM220_VALUE_FRESH;
+
+    if (!read_in_flight(self, reg))
+        self->refresh_mask |= SDM220_REGISTER_MASK(reg);
+
+    return read_time == 0u ? SDM220_VALUE_MISSING : SDM220_VALUE_STALE;
+}
+
+Sdm220RegisterMask sdm220_meter_refresh_pending(Sdm220Meter *self)
+{
+    return self->refresh_mask;
+}
+
+void sdm220_meter_refresh_cancel(Sdm220Meter *self, Sdm220RegisterMask mask)
+{
+    self->refresh_mask &= ~mask;
+}
+
+bool sdm220_meter_refresh_async(Sdm220Meter *self,
+                                unsigned timeout,
+                                Sdm220MeterErrorCallback error_callback,
+                                Sdm220MeterReadyCallback ready_callback,
+                                void *user_data)
+{
+    return sdm220_meter_poll_registers_async(self, self->refresh_mask, timeout,
+                                             error_callback, ready_callback, user_data);
+}
+
+mseconds_t sdm220_meter_get_latency(Sdm220Meter *self)
+{
+    return self->latency;
+}
+
+unsigned long sdm220_meter_get_dropped_bytes(Sdm220Meter *self)
+{
+    return self->dropped_bytes;
+}
+
+double sdm220_meter_get_latency_mean(Sdm220Meter *self)
+{
+    if (self->transactions == 0u)
+        return 0.0;
+
+    return self->latency_sum / (double) self->transactions;
+}
+
+void sdm220_meter_reset_latency_stats(Sdm220Meter *self)
+{
+    self->transactions = 0u;
+    self->latency_min = 0;
+    self->latency_max = 0;
+    self->latency_sum = 0.0;
+}
+
+mseconds_t sdm220_meter_get_timestamp(Sdm220Meter *self, Sdm220Register reg)
+{
+    if ((int) reg < 0 || reg >= SDM220_N_REGISTERS)
+        return 0u;
+
+    return self->timestamp_table[reg];
+}
+
+mseconds_t sdm220_meter_get_read_time(Sdm220Meter *self, Sdm220Register reg)
+{
+    if ((int) reg < 0 || reg >= SDM220_N_REGISTERS)
+        return 0u;
+
+    return self->read_time_table[reg];
+}
+
+const char *sdm220_register_name(Sdm220Register reg)
+{
+    if ((int) reg < 0 || reg >= SDM220_N_REGISTERS)
+        return NULL;
+
+    return register_names[reg];
+}
+
+bool sdm220_register_from_name(const char *name, size_t length, Sdm220Register *reg)
+{
+    int i = 0;
+
+    for (; i < SDM220_N_REGISTERS; ++i) {
+        if (strlen(register_names[i]) == length && strncmp(register_names[i], name, length) == 0) {
+            *reg = (Sdm220Register) i;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+double sdm220_meter_get_value(Sdm220Meter *self, Sdm220Register reg)
+{
+    if ((int) reg < 0 || reg >= SDM220_N_REGISTERS)
+        return 0.0;
+
+    return self->value_table[reg];
+}
+
 double sdm220_meter_get_voltage(Sdm220Meter *self)
 {
-    return self->value_table[INPUT_REG_VOLTAGE];
+    return self->value_table[SDM220_REGISTER_VOLTAGE];
 }
 
 double sdm220_meter_get_current(Sdm220Meter *self)
 {
-    return self->value_table[INPUT_REG_CURRENT];
+    return self->value_table[SDM220_REGISTER_CURRENT];
 }
 
 double sdm220_meter_get_active_power(Sdm220Meter *self)
 {
-    return self->value_table[INPUT_REG_ACTIVE_POWER];
+    return self->value_table[SDM220_REGISTER_ACTIVE_POWER];
 }
 
 double sdm220_meter_get_apparent_power(Sdm220Meter *self)
 {
-    return self->value_table[INPUT_REG_APPARENT_POWER];
+    return self->value_table[SDM220_REGISTER_APPARENT_POWER];
 }
 
 double sdm220_meter_get_reactive_power(Sdm220Meter *self)
 {
-    return self->value_table[INPUT_REG_REACTIVE_POWER];
+    return self->value_table[SDM220_REGISTER_REACTIVE_POWER];
 }
 
 double sdm220_meter_get_power_factor(Sdm220Meter *self)
 {
-    return self->value_table[INPUT_REG_POWER_FACTOR];
+    return self->value_table[SDM220_REGISTER_POWER_FACTOR];
 }
 
 double sdm220_meter_get_phase_angle(Sdm220Meter *self)
 {
-    return self->value_table[INPUT_REG_PHASE_ANGLE];
+    return self->value_table[SDM220_REGISTER_PHASE_ANGLE];
 }
 
 double sdm220_meter_get_frequency(Sdm220Meter *self)
 {
-    return self->value_table[INPUT_REG_FREQUENCY];
+    return self->value_table[SDM220_REGISTER_FREQUENCY];
 }
 
 double sdm220_meter_get_import_active_energy(Sdm220Meter *self)
 {
-    return self->value_table[INPUT_REG_IMPORT_ACTIVE_ENERGY];
+    return self->value_table[SDM220_REGISTER_IMPORT_ACTIVE_ENERGY];
 }
 
 double sdm220_meter_get_export_active_energy(Sdm220Meter *self)
 {
-    return self->value_table[INPUT_REG_EXPORT_ACTIVE_ENERGY];
+    return self->value_table[SDM220_REGISTER_EXPORT_ACTIVE_ENERGY];
 }
 
 double sdm220_meter_get_import_reactive_energy(Sdm220Meter *self)
 {
-    return self->value_table[INPUT_REG_IMPORT_REACTIVE_ENERGY];
+    return self->value_table[SDM220_REGISTER_IMPORT_REACTIVE_ENERGY];
 }
 
 double sdm220_meter_get_export_reactive_energy(Sdm220Meter *self)
 {
-    return self->value_table[INPUT_REG_EXPORT_REACTIVE_ENERGY];
+    return self->value_table[SDM220_REGISTER_EXPORT_REACTIVE_ENERGY];
 }
 
 double sdm220_meter_get_total_active_energy(Sdm220Meter *self)
 {
-    return self->value_table[INPUT_REG_TOTAL_ACTIVE_ENERGY];
+    return self->value_table[SDM220_REGISTER_TOTAL_ACTIVE_ENERGY];
 }
 
 double sdm220_meter_get_total_reactive_energy(Sdm220Meter *self)
 {
-    return self->value_table[INPUT_REG_TOTAL_REACTIVE_ENERGY];
+    return self->value_table[SDM220_REGISTER_TOTAL_REACTIVE_ENERGY];
 }
 
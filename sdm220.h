@@ -32,10 +32,15 @@
 #include <stdint.h>
 
 #include "input-stream.h"
+#include "task.h"
+#include "transport.h"
 
 typedef struct _Sdm220Meter Sdm220Meter;
 typedef struct _Sdm220MeterError Sdm220MeterError;
 typedef enum _Sdm220MeterErrorCode Sdm220MeterErrorCode;
+typedef enum _Sdm220Register Sdm220Register;
+typedef enum _Sdm220ValueStatus Sdm220ValueStatus;
+typedef uint32_t Sdm220RegisterMask;
 
 typedef void (*Sdm220MeterErrorCallback)(Sdm220Meter *, Sdm220MeterError *, void *);
 typedef void (*Sdm220MeterReadyCallback)(Sdm220Meter *, void *);
@@ -43,33 +48,77 @@ typedef void (*Sdm220MeterReadyCallback)(Sdm220Meter *, void *);
 enum _Sdm220MeterErrorCode {
 	SDM220_METER_ERROR_CODE_TIMEOUT = 1,
 	SDM220_METER_ERROR_CODE_BAD_RESPONSE,
-	SDM220_METER_ERROR_CODE_BUFFER_OVERFLOW
+	SDM220_METER_ERROR_CODE_BUFFER_OVERFLOW,
+	SDM220_METER_ERROR_CODE_EXCEPTION
 };
 
-#define SDM220_BUFFER_SIZE 	16
-#define SDM220_VALUE_TABLE_SIZE	14
+enum _Sdm220Register {
+	SDM220_REGISTER_VOLTAGE = 0,
+	SDM220_REGISTER_CURRENT,
+	SDM220_REGISTER_ACTIVE_POWER,
+	SDM220_REGISTER_APPARENT_POWER,
+	SDM220_REGISTER_REACTIVE_POWER,
+	SDM220_REGISTER_POWER_FACTOR,
+	SDM220_REGISTER_PHASE_ANGLE,
+	SDM220_REGISTER_FREQUENCY,
+	SDM220_REGISTER_IMPORT_ACTIVE_ENERGY,
+	SDM220_REGISTER_EXPORT_ACTIVE_ENERGY,
+	SDM220_REGISTER_IMPORT_REACTIVE_ENERGY,
+	SDM220_REGISTER_EXPORT_REACTIVE_ENERGY,
+	SDM220_REGISTER_TOTAL_ACTIVE_ENERGY,
+	SDM220_REGISTER_TOTAL_REACTIVE_ENERGY,
+
+	SDM220_N_REGISTERS
+};
+
+enum _Sdm220ValueStatus {
+	SDM220_VALUE_FRESH = 0,
+	SDM220_VALUE_STALE,
+	SDM220_VALUE_MISSING
+};
+
+#define SDM220_REGISTER_MASK(reg)	((Sdm220RegisterMask) 1u << (reg))
+#define SDM220_REGISTER_MASK_ALL	(SDM220_REGISTER_MASK(SDM220_N_REGISTERS) - 1u)
+
+#define SDM220_BUFFER_SIZE 	32
+#define SDM220_VALUE_TABLE_SIZE	SDM220_N_REGISTERS
 
 struct _Sdm220MeterError {
 	Sdm220MeterErrorCode code;
+	uint8_t exception_code;	/* Modbus exception, with SDM220_METER_ERROR_CODE_EXCEPTION */
 };
 
 struct _Sdm220Meter {
 	uint8_t slave_address;
+	Transport *transport;
 	InputStream istream;
 	uint8_t buffer[SDM220_BUFFER_SIZE];
 	double value_table[SDM220_VALUE_TABLE_SIZE];
+	mseconds_t timestamp_table[SDM220_VALUE_TABLE_SIZE];
+	mseconds_t read_time_table[SDM220_VALUE_TABLE_SIZE];	/* timer_monotonic(), for ages */
 	size_t buffer_size;
 	size_t data_size;
-	int state;
+	Task task;
 	int next_input_register;
+	int run_size;	/* registers read by the request in flight */
+	Sdm220RegisterMask poll_mask;
+	Sdm220RegisterMask refresh_mask;
 	bool error_flag;
 	unsigned timeout;
+	Timer latency_timer;
+	mseconds_t latency;
+	unsigned long transactions;
+	long latency_min;	/* usec */
+	long latency_max;	/* usec */
+	double latency_sum;	/* usec */
+	unsigned long dropped_bytes;
+	uint8_t flight_state;	/* FlightState, last one recorded */
 	Sdm220MeterErrorCallback error_callback;
 	Sdm220MeterReadyCallback ready_callback;
 	void *user_data;
 };
 
-void sdm220_meter_init(Sdm220Meter *self, uint8_t addr);
+void sdm220_meter_init(Sdm220Meter *self, Transport *transport, uint8_t addr);
 void sdm220_meter_iterate(Sdm220Meter *self);
 bool sdm220_meter_async_poll_pending(Sdm220Meter *self);
 
@@ -79,6 +128,45 @@ bool sdm220_meter_poll_async(Sdm220Meter *self,
 			     Sdm220MeterReadyCallback ready_callback,
 			     void *user_data);
 
+bool sdm220_meter_poll_registers_async(Sdm220Meter *self,
+				       Sdm220RegisterMask mask,
+				       unsigned timeout,
+				       Sdm220MeterErrorCallback error_callback,
+				       Sdm220MeterReadyCallback ready_callback,
+				       void *user_data);
+
+/*
+ * Cached reads. A value younger than max_age (ms) is FRESH. An older one is
+ * returned as STALE and a never read one as MISSING (value 0), both queue
+ * the register for a refresh. Requests for the same register coalesce with
+ * each other and with a poll that is going to read it anyway, the owner of
+ * the bus serves what is left with sdm220_meter_refresh_async().
+ */
+Sdm220ValueStatus sdm220_meter_read_cached(Sdm220Meter *self, Sdm220Register reg,
+					   mseconds_t max_age, double *value);
+Sdm220RegisterMask sdm220_meter_refresh_pending(Sdm220Meter *self);
+void sdm220_meter_refresh_cancel(Sdm220Meter *self, Sdm220RegisterMask mask);
+bool sdm220_meter_refresh_async(Sdm220Meter *self,
+				unsigned timeout,
+				Sdm220MeterErrorCallback error_callback,
+				Sdm220MeterReadyCallback ready_callback,
+				void *user_data);
+
+mseconds_t sdm220_meter_get_latency(Sdm220Meter *self);
+double sdm220_meter_get_latency_mean(Sdm220Meter *self);
+unsigned long sdm220_meter_get_dropped_bytes(Sdm220Meter *self);
+void sdm220_meter_reset_latency_stats(Sdm220Meter *self);
+mseconds_t sdm220_meter_get_timestamp(Sdm220Meter *self, Sdm220Register reg);
+mseconds_t sdm220_meter_get_read_time(Sdm220Meter *self, Sdm220Register reg);
+
+/*
+ * Short snake_case names ("active_power"), as used on the command line and
+ * in exported data.
+ */
+const char *sdm220_register_name(Sdm220Register reg);
+bool sdm220_register_from_name(const char *name, size_t length, Sdm220Register *reg);
+
+double sdm220_meter_get_value(Sdm220Meter *self, Sdm220Register reg);
 double sdm220_meter_get_voltage(Sdm220Meter *self);
 double sdm220_meter_get_current(Sdm220Meter *self);
 double sdm220_meter_get_active_power(Sdm220Meter *self);
@@ -0,0 +1,420 @@
+/**
+ * @file sdm220.hpp
+ * @author Sereda Anton <sereda-anton@yandex.ru>
+ *
+ * Copyright (c) 2017 Sereda Anton
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+#ifndef SDM220_HPP
+#define SDM220_HPP
+
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <optional>
+#include <type_traits>
+
+extern "C" {
+#include "modbus.h"
+#include "transport.h"
+}
+
+/*
+ * C++17 layer over the C library. Registers are types, and the set asked
+ * for is planned at compile time:
+ *
+ *     sdm220::Meter meter(&port.transport, 1);
+ *     auto values = meter.read<sdm220::Voltage, sdm220::Current, sdm220::ActivePower>();
+ *
+ *     if (values)
+ *         use(values->get<sdm220::Voltage>());
+ *
+ * Plan<...> sorts the register addresses and merges them into as few FC04
+ * requests as possible, reading across short gaps rather than paying for
+ * another round trip. The request frames, CRC included, exist for every
+ * slave address in read-only data; the hot path sends them as they are
+ * and decodes every value from a fixed offset in its response.
+ */
+
+namespace sdm220 {
+
+/*
+ * 'index' is the register's Sdm220Register value (sdm220.h is C only, its
+ * enums are forward declared).
+ */
+#define SDM220_HPP_REGISTER(name, index_, address_) \
+    struct name { \
+        static constexpr int index = index_; \
+        static constexpr std::uint16_t address = address_; \
+    }
+
+SDM220_HPP_REGISTER(Voltage,              0,  0x0000);
+SDM220_HPP_REGISTER(Current,              1,  0x0006);
+SDM220_HPP_REGISTER(ActivePower,          2,  0x000c);
+SDM220_HPP_REGISTER(ApparentPower,        3,  0x0012);
+SDM220_HPP_REGISTER(ReactivePower,        4,  0x0018);
+SDM220_HPP_REGISTER(PowerFactor,          5,  0x001e);
+SDM220_HPP_REGISTER(PhaseAngle,           6,  0x0024);
+SDM220_HPP_REGISTER(Frequency,            7,  0x0046);
+SDM220_HPP_REGISTER(ImportActiveEnergy,   8,  0x0048);
+SDM220_HPP_REGISTER(ExportActiveEnergy,   9,  0x004a);
+SDM220_HPP_REGISTER(ImportReactiveEnergy, 10, 0x004c);
+SDM220_HPP_REGISTER(ExportReactiveEnergy, 11, 0x004e);
+SDM220_HPP_REGISTER(TotalActiveEnergy,    12, 0x0156);
+SDM220_HPP_REGISTER(TotalReactiveEnergy,  13, 0x0158);
+
+#undef SDM220_HPP_REGISTER
+
+/*
+ * Registers (16 bit) per value, and how far a request may read past
+ * registers nobody asked for: 16 unused registers cost 32 bytes on the
+ * wire, about what a separate request costs in framing and turnaround.
+ */
+constexpr std::size_t kRegistersPerValue = 2;
+constexpr std::size_t kMaxGap = 16;
+constexpr std::size_t kMaxQuantity = 124;
+constexpr std::size_t kMaxAddress = 247;
+
+constexpr std::uint16_t crc16(const std::uint8_t *data, std::size_t size)
+{
+    std::uint16_t crc = 0xffff;
+
+    for (std::size_t i = 0; i < size; ++i) {
+        crc ^= data[i];
+
+        for (int bit = 0; bit < 8; ++bit)
+            crc = (crc & 1u) != 0 ? static_cast<std::uint16_t>((crc >> 1) ^ 0xa001)
+                                  : static_cast<std::uint16_t>(crc >> 1);
+    }
+
+    return crc;
+}
+
+struct Range {
+    std::uint16_t start = 0;
+    std::uint16_t quantity = 0;     /* registers */
+};
+
+struct Slot {
+    std::size_t frame = 0;
+    std::size_t offset = 0;         /* byte offset of the value in the response */
+};
+
+using Request = std::array<std::uint8_t, MODBUS_RTU_REQUEST_SIZE>;
+
+namespace detail {
+
+template <std::size_t N>
+constexpr std::array<std::uint16_t, N> sorted(std::array<std::uint16_t, N> addresses)
+{
+    for (std::size_t i = 1; i < N; ++i) {
+        for (std::size_t j = i; j > 0 && addresses[j - 1] > addresses[j]; --j) {
+            std::uint16_t tmp = addresses[j - 1];
+            addresses[j - 1] = addresses[j];
+            addresses[j] = tmp;
+        }
+    }
+
+    return addresses;
+}
+
+/*
+ * Starts a new frame unless the next value is close enough to the open one
+ * and still fits in a single request. Walks the sorted addresses, filling
+ * 'ranges' when given and returning how many frames it took.
+ */
+template <std::size_t N>
+constexpr std::size_t coalesce(const std::array<std::uint16_t, N> &addresses, Range *ranges)
+{
+    std::size_t n_ranges = 0;
+    std::uint16_t start = 0;
+    std::uint16_t end = 0;
+
+    for (std::size_t i = 0; i < N; ++i) {
+        std::uint16_t address = addresses[i];
+        std::uint16_t address_end = static_cast<std::uint16_t>(address + kRegistersPerValue);
+
+        if (n_ranges != 0 && address <= end + kMaxGap
+            && static_cast<std::size_t>(address_end - start) <= kMaxQuantity) {
+            if (address_end > end)
+                end = address_end;
+        } else {
+            if (n_ranges != 0 && ranges != nullptr)
+                ranges[n_ranges - 1] = Range{start, static_cast<std::uint16_t>(end - start)};
+
+            start = address;
+            end = address_end;
+            n_ranges++;
+        }
+    }
+
+    if (n_ranges != 0 && ranges != nullptr)
+        ranges[n_ranges - 1] = Range{start, static_cast<std::uint16_t>(end - start)};
+
+    return n_ranges;
+}
+
+constexpr Request build_request(std::uint8_t slave_address, const Range &range)
+{
+    Request frame{};
+
+    frame[0] = slave_address;
+    frame[1] = MODBUS_READ_INPUT_REGISTERS;
+    frame[2] = static_cast<std::uint8_t>(range.start >> 8);
+    frame[3] = static_cast<std::uint8_t>(range.start & 0xff);
+    frame[4] = static_cast<std::uint8_t>(range.quantity >> 8);
+    frame[5] = static_cast<std::uint8_t>(range.quantity & 0xff);
+
+    std::uint16_t crc = crc16(frame.data(), 6);
+
+    frame[6] = static_cast<std::uint8_t>(crc & 0xff);
+    frame[7] = static_cast<std::uint8_t>(crc >> 8);
+
+    return frame;
+}
+
+template <typename Reg, typename... Regs>
+constexpr std::size_t index_of()
+{
+    constexpr bool matches[] = {std::is_same_v<Reg, Regs>...};
+
+    for (std::size_t i = 0; i < sizeof...(Regs); ++i) {
+        if (matches[i])
+            return i;
+    }
+
+    return sizeof...(Regs);
+}
+
+inline float parse_float_be(const std::uint8_t *bytes)
+{
+    std::uint32_t bits = static_cast<std::uint32_t>(bytes[0]) << 24
+        | static_cast<std::uint32_t>(bytes[1]) << 16
+        | static_cast<std::uint32_t>(bytes[2]) << 8
+        | static_cast<std::uint32_t>(bytes[3]);
+    float value = 0.0f;
+
+    std::memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+} /* namespace detail */
+
+template <typename... Regs>
+struct Plan {
+    static_assert(sizeof...(Regs) != 0, "a plan needs at least one register");
+
+    static constexpr std::size_t n_values = sizeof...(Regs);
+    static constexpr std::array<std::uint16_t, n_values> addresses = {Regs::address...};
+    static constexpr std::array<std::uint16_t, n_values> sorted = detail::sorted(addresses);
+    static constexpr std::size_t n_frames = detail::coalesce(sorted, nullptr);
+
+    static constexpr std::array<Range, n_frames> make_ranges()
+    {
+        std::array<Range, n_frames> ranges{};
+
+        detail::coalesce(sorted, ranges.data());
+        return ranges;
+    }
+
+    static constexpr std::array<Range, n_frames> ranges = make_ranges();
+
+    /*
+     * Where each value, in the order the registers were asked for, sits in
+     * the responses: header (address, function, byte count) then data.
+     */
+    static constexpr std::array<Slot, n_values> make_slots()
+    {
+        std::array<Slot, n_values> slots{};
+
+        for (std::size_t i = 0; i < n_values; ++i) {
+            for (std::size_t f = 0; f < n_frames; ++f) {
+                if (addresses[i] >= ranges[f].start
+                    && addresses[i] < ranges[f].start + ranges[f].quantity) {
+                    slots[i] = Slot{f, 3 + 2 * static_cast<std::size_t>(addresses[i] - ranges[f].start)};
+                    break;
+                }
+            }
+        }
+
+        return slots;
+    }
+
+    static constexpr std::array<Slot, n_values> slots = make_slots();
+
+    static constexpr std::size_t response_size(std::size_t frame)
+    {
+        return 5 + 2 * static_cast<std::size_t>(ranges[frame].quantity);
+    }
+
+    static constexpr std::size_t max_response_size()
+    {
+        std::size_t size = 0;
+
+        for (std::size_t f = 0; f < n_frames; ++f) {
+            if (response_size(f) > size)
+                size = response_size(f);
+        }
+
+        return size;
+    }
+
+    using Requests = std::array<Request, n_frames>;
+
+    static constexpr std::array<Requests, kMaxAddress + 1> make_requests()
+    {
+        std::array<Requests, kMaxAddress + 1> requests{};
+
+        for (std::size_t address = 1; address <= kMaxAddress; ++address) {
+            for (std::size_t f = 0; f < n_frames; ++f)
+                requests[address][f] = detail::build_request(static_cast<std::uint8_t>(address),
+                                                             ranges[f]);
+        }
+
+        return requests;
+    }
+
+    static constexpr std::array<Requests, kMaxAddress + 1> requests = make_requests();
+};
+
+template <typename... Regs>
+class Values {
+public:
+    template <typename Reg>
+    float get() const
+    {
+        constexpr std::size_t index = detail::index_of<Reg, Regs...>();
+        static_assert(index < sizeof...(Regs), "register was not part of the read");
+
+        return values_[index];
+    }
+
+    std::array<float, sizeof...(Regs)> &data() { return values_; }
+    const std::array<float, sizeof...(Regs)> &data() const { return values_; }
+
+private:
+    std::array<float, sizeof...(Regs)> values_{};
+};
+
+/*
+ * Blocking reads over any Transport (serial port, gateway channel). A
+ * response is only taken when its header is exactly the expected one and
+ * its CRC checks; bytes in front of it are skipped.
+ */
+class Meter {
+public:
+    Meter(Transport *transport, std::uint8_t slave_address,
+          std::chrono::milliseconds timeout = std::chrono::milliseconds(1000))
+        : transport_(transport), slave_address_(slave_address), timeout_(timeout)
+    {
+    }
+
+    std::uint8_t slave_address() const { return slave_address_; }
+
+    template <typename... Regs>
+    std::optional<Values<Regs...>> read()
+    {
+        using P = Plan<Regs...>;
+
+        Values<Regs...> values;
+        std::array<std::uint8_t, P::max_response_size()> response{};
+
+        if (slave_address_ == 0 || slave_address_ > kMaxAddress)
+            return std::nullopt;
+
+        for (std::size_t f = 0; f < P::n_frames; ++f) {
+            if (!transact(P::requests[slave_address_][f], response.data(), P::response_size(f)))
+                return std::nullopt;
+
+            for (std::size_t i = 0; i < P::n_values; ++i) {
+                if (P::slots[i].frame == f)
+                    values.data()[i] = detail::parse_float_be(response.data() + P::slots[i].offset);
+            }
+        }
+
+        return values;
+    }
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    bool header_matches(const std::uint8_t *response, std::size_t size,
+                        std::size_t response_size) const
+    {
+        const std::uint8_t header[3] = {
+            slave_address_, MODBUS_READ_INPUT_REGISTERS,
+            static_cast<std::uint8_t>(response_size - 5)
+        };
+
+        for (std::size_t i = 0; i < size && i < 3; ++i) {
+            if (response[i] != header[i])
+                return false;
+        }
+
+        return true;
+    }
+
+    bool transact(const Request &request, std::uint8_t *response, std::size_t response_size)
+    {
+        std::size_t size = 0;
+        std::uint8_t byte = 0;
+        Request frame = request;
+        const auto deadline = Clock::now() + timeout_;
+
+        transport_write(transport_, frame.data(), frame.size());
+
+        while (size < response_size) {
+            if (!transport_poll(transport_)) {
+                auto left = std::chrono::duration_cast<std::chrono::milliseconds>(
+                    deadline - Clock::now());
+
+                if (left.count() <= 0)
+                    return false;
+
+                transport_wait(transport_, static_cast<int>(left.count()));
+                continue;
+            }
+
+            if (!transport_read_byte(transport_, &byte))
+                continue;
+
+            response[size++] = byte;
+
+            while (size != 0 && !header_matches(response, size, response_size)) {
+                std::memmove(response, response + 1, size - 1);
+                size--;
+            }
+        }
+
+        return modbus_crc16_check(response, response_size);
+    }
+
+    Transport *transport_;
+    std::uint8_t slave_address_;
+    std::chrono::milliseconds timeout_;
+};
+
+} /* namespace sdm220 */
+
+#endif /* SDM220_HPP */
@@ -0,0 +1,138 @@
+#include <string.h>
+
+#include "task.h"
+#include "flight-recorder.h"
+
+void task_init(Task *self, TaskFunc func, void *user_data)
+{
+    self->line = 0u;
+    self->func = func;
+    self->timeout = 0u;
+    self->istream = NULL;
+    self->bus = 0u;
+    self->io_size = 0u;
+    self->next = NULL;
+    self->user_data = user_data;
+
+    timer_init(&self->timer);
+    runtime_error_clear(&self->error);
+}
+
+int task_run(Task *self)
+{
+    if (self->func == NULL)
+        return TASK_DONE;
+
+    return self->func(self);
+}
+
+bool task_running(Task *self)
+{
+    return self->line != 0u;
+}
+
+bool task_failed(Task *self)
+{
+    return self->error.code != 0;
+}
+
+static void on_read_ready(InputStream *istream, RuntimeError *error, uint8_t *buf,
+                          size_t size, void *user_data)
+{
+    Task *self = user_data;
+
+    self->io_size = size;
+    if (error != NULL)
+        self->error = *error;
+
+    if (error != NULL && error->code == INPUT_STREAM_ERROR_TIMEOUT)
+        flight_recorder_record(FLIGHT_EVENT_TIMEOUT, self->bus, (uint32_t) size, buf, size);
+    else
+        flight_recorder_record(FLIGHT_EVENT_RX, self->bus, (uint32_t) size, buf, size);
+}
+
+void task_read_begin(Task *self, InputStream *istream, uint8_t *buffer, size_t size,
+                     mseconds_t timeout)
+{
+    self->istream = istream;
+    self->io_size = 0u;
+    runtime_error_clear(&self->error);
+
+    input_stream_read_async(istream, timeout, buffer, size, on_read_ready, self);
+}
+
+bool task_read_poll(Task *self)
+{
+    if (input_stream_pending(self->istream))
+        input_stream_run(self->istream);
+
+    return !input_stream_pending(self->istream);
+}
+
+void task_write(Task *self, Transport *transport, uint8_t *buffer, size_t size)
+{
+    runtime_error_clear(&self->error);
+    self->bus = transport->bus;
+    transport_write(transport, buffer, size);
+}
+
+void task_timer_begin(Task *self, mseconds_t timeout)
+{
+    self->timeout = timeout;
+    timer_start(&self->timer);
+}
+
+bool task_timer_expired(Task *self)
+{
+    return timer_elapsed(&self->timer) >= self->timeout;
+}
+
+void task_loop_init(TaskLoop *self)
+{
+    self->head = NULL;
+    self->size = 0u;
+}
+
+void task_loop_add(TaskLoop *self, Task *task)
+{
+    task->next = self->head;
+    self->head = task;
+    self->size++;
+}
+
+void task_loop_remove(TaskLoop *self, Task *task)
+{
+    Task **link = &self->head;
+
+    for (; *link != NULL; link = &(*link)->next) {
+        if (*link == task) {
+            *link = task->next;
+            task->next = NULL;
+            self->size--;
+            return;
+        }
+    }
+}
+
+bool task_loop_pending(TaskLoop *self)
+{
+    return self->head != NULL;
+}
+
+void task_loop_run_once(TaskLoop *self)
+{
+    Task *task = NULL;
+    Task *next = NULL;
+    Task **link = &self->head;
+
+    for (task = self->head; task != NULL; task = next) {
+        next = task->next;
+
+        if (task_run(task) == TASK_DONE) {
+            *link = next;
+            task->next = NULL;
+            self->size--;
+        } else
+            link = &task->next;
+    }
+}
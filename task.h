@@ -0,0 +1,127 @@
+/**
+ * @file task.h
+ * @author Sereda Anton <sereda-anton@yandex.ru>
+ *
+ * Copyright (c) 2017 Sereda Anton
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+#ifndef TASK_H
+#define TASK_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "timer.h"
+#include "runtime-error.h"
+#include "input-stream.h"
+#include "transport.h"
+
+/*
+ * Stackless (protothread style) tasks. A task body is an ordinary function
+ * written top to bottom between TASK_BEGIN() and TASK_END(); every await_*()
+ * returns to the caller while the operation is in flight and resumes right
+ * after it on the next task_run(). Resume point, timer and I/O status live in
+ * the Task itself, so a task costs sizeof(Task) and nothing is allocated.
+ *
+ * NOTE: Local variables do NOT survive an await, keep state in the structure
+ * that embeds the Task. Only one await per source line.
+ */
+
+typedef struct _Task Task;
+typedef struct _TaskLoop TaskLoop;
+
+typedef int (*TaskFunc)(Task *);
+
+enum {
+    TASK_WAITING = 0,
+    TASK_DONE
+};
+
+struct _Task {
+    unsigned int line;
+    TaskFunc func;
+    Timer timer;
+    mseconds_t timeout;
+    InputStream *istream;
+    uint16_t bus;           /* of the last write, the response comes back on it */
+    RuntimeError error;
+    size_t io_size;
+    Task *next;
+    void *user_data;
+};
+
+struct _TaskLoop {
+    Task *head;
+    size_t size;
+};
+
+#define TASK_BEGIN(task) \
+    switch ((task)->line) { case 0:
+
+#define TASK_END(task) \
+    } (task)->line = 0u; return TASK_DONE
+
+#define TASK_EXIT(task) \
+    do { (task)->line = 0u; return TASK_DONE; } while (0)
+
+#define TASK_WAIT_UNTIL(task, condition) \
+    do { (task)->line = __LINE__; /* fall through */ case __LINE__: \
+        if (!(condition)) return TASK_WAITING; } while (0)
+
+#define TASK_YIELD(task) \
+    do { (task)->line = __LINE__; return TASK_WAITING; case __LINE__:; } while (0)
+
+#define await_read(task, istream, buffer, size, timeout) \
+    do { task_read_begin((task), (istream), (buffer), (size), (timeout)); \
+        TASK_WAIT_UNTIL((task), task_read_poll(task)); } while (0)
+
+#define await_write(task, transport, buffer, size) \
+    do { task_write((task), (transport), (buffer), (size)); TASK_YIELD(task); } while (0)
+
+#define await_timeout(task, timeout) \
+    do { task_timer_begin((task), (timeout)); \
+        TASK_WAIT_UNTIL((task), task_timer_expired(task)); } while (0)
+
+void task_init(Task *self, TaskFunc func, void *user_data);
+int task_run(Task *self);
+bool task_running(Task *self);
+bool task_failed(Task *self);
+
+void task_read_begin(Task *self, InputStream *istream, uint8_t *buffer, size_t size,
+                     mseconds_t timeout);
+bool task_read_poll(Task *self);
+void task_write(Task *self, Transport *transport, uint8_t *buffer, size_t size);
+void task_timer_begin(Task *self, mseconds_t timeout);
+bool task_timer_expired(Task *self);
+
+/*
+ * NOTE: Finished tasks are unlinked by task_loop_run_once(). Tasks must not
+ * add or remove tasks of the loop they are running in.
+ */
+void task_loop_init(TaskLoop *self);
+void task_loop_add(TaskLoop *self, Task *task);
+void task_loop_remove(TaskLoop *self, Task *task);
+bool task_loop_pending(TaskLoop *self);
+void task_loop_run_once(TaskLoop *self);
+
+#endif /* TASK_H */
@@ -8,9 +8,9 @@ void timer_init(Timer *timer)
     timer_start(timer);
 }
 
-static inline void get_time(struct timespec *tp)
+static inline void get_time(clockid_t clock, struct timespec *tp)
 {
-    if (clock_gettime(CLOCK_REALTIME, tp) != 0) {
+    if (clock_gettime(clock, tp) != 0) {
         perror("clock_gettime");
         exit(EXIT_FAILURE);
     }
@@ -18,7 +18,7 @@ static inline void get_time(struct timespec *tp)
 
 void timer_start(Timer *timer)
 {
-    get_time(&timer->start);
+    get_time(CLOCK_MONOTONIC, &timer->start);
 }
 
 static inline void timespec_diff(struct timespec *start, struct timespec *stop,
@@ -45,7 +45,7 @@ mseconds_t timer_elapsed(Timer *timer)
     struct timespec now = {0, };
     struct timespec *start = NULL;
 
-    get_time(&now);
+    get_time(CLOCK_MONOTONIC, &now);
     start = &timer->start;
 
     if (now.tv_nsec >= start->tv_nsec)
@@ -64,7 +64,41 @@ mseconds_t timer_elapsed(Timer *timer)
     return result;
 }
 
+long timer_elapsed_us(Timer *timer)
+{
+    struct timespec now = {0, };
+
+    get_time(CLOCK_MONOTONIC, &now);
+
+    return (long) (now.tv_sec - timer->start.tv_sec) * 1000000l
+        + (now.tv_nsec - timer->start.tv_nsec) / 1000l;
+}
+
 void timer_reset(Timer *timer)
 {
     timer_start(timer);
 }
+
+mseconds_t timer_timestamp(void)
+{
+    struct timespec now = {0, };
+
+    get_time(CLOCK_REALTIME, &now);
+    return (mseconds_t) now.tv_sec * 1000u + (mseconds_t) (now.tv_nsec / 1000000);
+}
+
+mseconds_t timer_monotonic(void)
+{
+    struct timespec now = {0, };
+
+    get_time(CLOCK_MONOTONIC, &now);
+    return (mseconds_t) now.tv_sec * 1000u + (mseconds_t) (now.tv_nsec / 1000000);
+}
+
+uint64_t timer_timestamp_ns(void)
+{
+    struct timespec now = {0, };
+
+    get_time(CLOCK_REALTIME, &now);
+    return (uint64_t) now.tv_sec * 1000000000u + (uint64_t) now.tv_nsec;
+}
@@ -9,6 +9,12 @@
 typedef unsigned long mseconds_t;
 typedef struct _Timer Timer;
 
+/*
+ * Timers measure on the monotonic clock, so a clock step never makes an
+ * elapsed time jump or go negative. Timestamps are wall clock time,
+ * timer_monotonic() is the monotonic one in the same unit: only good for
+ * telling how long ago something happened.
+ */
 struct _Timer {
 	struct timespec start;
 };
@@ -16,6 +22,10 @@ struct _Timer {
 void timer_init(Timer *timer);
 void timer_start(Timer *timer);
 mseconds_t timer_elapsed(Timer *timer);
+long timer_elapsed_us(Timer *timer);
 void timer_reset(Timer *timer);
+mseconds_t timer_timestamp(void);
+mseconds_t timer_monotonic(void);
+uint64_t timer_timestamp_ns(void);
 
 #endif /* TIMER_H */
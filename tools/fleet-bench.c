@@ -0,0 +1,139 @@
+/*
+ * Times cross-meter scans over a fleet: the structure of arrays store
+ * against the same scan over an array of Sdm220Meter.
+ *
+ * Build: cc -O3 -I. -o fleet-bench tools/fleet-bench.c fleet.c timer.c
+ * Run:   ./fleet-bench [<meters> [<repetitions>]]
+ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "timer.h"
+#include "sdm220.h"
+#include "fleet.h"
+
+#define DEFAULT_METERS      50000
+#define DEFAULT_REPETITIONS 200
+#define THRESHOLD           5000.0f
+
+static volatile double sink_double;
+static volatile size_t sink_size;
+
+static double aos_sum(Sdm220Meter *meters, const uint8_t *good, size_t n)
+{
+    size_t i = 0u;
+    double sum = 0.0;
+
+    for (; i < n; ++i) {
+        if (good[i])
+            sum += meters[i].value_table[SDM220_REGISTER_ACTIVE_POWER];
+    }
+
+    return sum;
+}
+
+static size_t aos_count_above(Sdm220Meter *meters, const uint8_t *good, size_t n)
+{
+    size_t i = 0u;
+    size_t count = 0u;
+
+    for (; i < n; ++i) {
+        if (good[i] && meters[i].value_table[SDM220_REGISTER_ACTIVE_POWER] > THRESHOLD)
+            count++;
+    }
+
+    return count;
+}
+
+static double per_pass_us(Timer *timer, unsigned repetitions)
+{
+    return (double) timer_elapsed_us(timer) / repetitions;
+}
+
+int main(int argc, char **argv)
+{
+    size_t i = 0u;
+    unsigned r = 0u;
+    size_t n = DEFAULT_METERS;
+    unsigned repetitions = DEFAULT_REPETITIONS;
+    Sdm220Fleet fleet;
+    Sdm220Meter *meters = NULL;
+    uint8_t *good = NULL;
+    size_t *indices = NULL;
+    Timer timer;
+
+    if (argc > 1)
+        n = strtoul(argv[1], NULL, 0);
+
+    if (argc > 2)
+        repetitions = (unsigned) strtoul(argv[2], NULL, 0);
+
+    meters = calloc(n, sizeof(Sdm220Meter));
+    good = calloc(n, sizeof(uint8_t));
+    indices = calloc(n, sizeof(size_t));
+
+    if (meters == NULL || good == NULL || indices == NULL || n == 0u || repetitions == 0u
+        || !sdm220_fleet_init(&fleet, n)) {
+        fprintf(stderr, "Unable to set up %zu meters.\n", n);
+        return EXIT_FAILURE;
+    }
+
+    srand(1);
+
+    /*
+     * Powers up to 10 kW, one meter in sixteen is stale.
+     */
+    for (; i < n; ++i) {
+        meters[i].slave_address = (uint8_t) (i % 247u + 1u);
+        meters[i].value_table[SDM220_REGISTER_ACTIVE_POWER] = (double) (rand() % 10000);
+        meters[i].timestamp_table[SDM220_REGISTER_ACTIVE_POWER] = 1u;
+        meters[i].poll_mask = SDM220_REGISTER_MASK_ALL;
+        good[i] = (i % 16u) != 0u;
+
+        sdm220_fleet_add(&fleet, meters[i].slave_address);
+        sdm220_fleet_store(&fleet, i, &meters[i]);
+
+        if (!good[i])
+            sdm220_fleet_mark_stale(&fleet, i);
+    }
+
+    printf("%zu meters, %u passes each, resident bytes per meter: "
+           "Sdm220Meter %zu, fleet %zu\n", n, repetitions, sizeof(Sdm220Meter),
+           sizeof(uint8_t)
+           + SDM220_N_REGISTERS * (sizeof(uint8_t) + sizeof(mseconds_t) + sizeof(float)));
+
+    timer_start(&timer);
+    for (r = 0u; r < repetitions; ++r)
+        sink_double = aos_sum(meters, good, n);
+    printf("sum         Sdm220Meter[] %9.1f us   ", per_pass_us(&timer, repetitions));
+
+    timer_start(&timer);
+    for (r = 0u; r < repetitions; ++r)
+        sink_double = sdm220_fleet_sum(&fleet, SDM220_REGISTER_ACTIVE_POWER);
+    printf("fleet %9.1f us   (%.0f W)\n", per_pass_us(&timer, repetitions), sink_double);
+
+    timer_start(&timer);
+    for (r = 0u; r < repetitions; ++r)
+        sink_size = aos_count_above(meters, good, n);
+    printf("count_above Sdm220Meter[] %9.1f us   ", per_pass_us(&timer, repetitions));
+
+    timer_start(&timer);
+    for (r = 0u; r < repetitions; ++r)
+        sink_size = sdm220_fleet_count_above(&fleet, SDM220_REGISTER_ACTIVE_POWER, THRESHOLD);
+    printf("fleet %9.1f us   (%zu meters)\n", per_pass_us(&timer, repetitions), sink_size);
+
+    timer_start(&timer);
+    for (r = 0u; r < repetitions; ++r)
+        sink_size = sdm220_fleet_select_above(&fleet, SDM220_REGISTER_ACTIVE_POWER, THRESHOLD,
+                                              indices, n);
+    printf("select_above                          fleet %9.1f us   (%zu meters)\n",
+           per_pass_us(&timer, repetitions), sink_size);
+
+    sdm220_fleet_destroy(&fleet);
+    free(indices);
+    free(good);
+    free(meters);
+
+    return 0;
+}
@@ -0,0 +1,224 @@
+/*
+ * Prints a flight recorder dump as an annotated Modbus timeline.
+ *
+ * Build: cc -I. -o flight-decode tools/flight-decode.c flight-recorder.c modbus.c
+ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "modbus.h"
+#include "flight-recorder.h"
+
+static const char *error_names[] = {
+    [1] = "timeout",
+    [2] = "bad response",
+    [3] = "buffer overflow",
+    [4] = "exception"
+};
+
+static const char *exception_names[] = {
+    [1]  = "illegal function",
+    [2]  = "illegal data address",
+    [3]  = "illegal data value",
+    [4]  = "slave device failure",
+    [5]  = "acknowledge",
+    [6]  = "slave device busy",
+    [8]  = "memory parity error",
+    [10] = "gateway path unavailable",
+    [11] = "gateway target failed to respond"
+};
+
+static const char *lookup(const char **names, size_t n_names, unsigned code)
+{
+    if (code >= n_names || names[code] == NULL)
+        return "unknown";
+
+    return names[code];
+}
+
+static void print_bytes(const FlightEvent *event)
+{
+    size_t i = 0u;
+
+    for (; i < event->size; ++i)
+        printf(" %02x", event->data[i]);
+
+    if (event->arg > event->size)
+        printf(" ...");
+
+    printf("\n");
+}
+
+static void annotate_tx(const FlightEvent *event)
+{
+    const uint8_t *frame = event->data;
+
+    if (event->size < MODBUS_RTU_REQUEST_SIZE) {
+        printf("      %u byte request\n", (unsigned) event->arg);
+        return;
+    }
+
+    printf("      slave %u, function %u, register 0x%04x, count %u%s\n",
+           (unsigned) frame[0], (unsigned) frame[1],
+           (unsigned) (frame[2] << 8 | frame[3]), (unsigned) (frame[4] << 8 | frame[5]),
+           modbus_crc16_check(frame, MODBUS_RTU_REQUEST_SIZE) ? "" : ", BAD CRC");
+}
+
+/*
+ * Receive chunks are what one read returned: a header, the rest of a frame,
+ * or both. They are reassembled into the response to the last request.
+ */
+static uint8_t frame[MODBUS_RTU_MAX_FRAME_SIZE];
+static size_t frame_size = 0u;
+
+static void annotate_rx(const FlightEvent *event)
+{
+    size_t size = 0u;
+
+    if (frame_size + event->size > sizeof(frame))
+        frame_size = 0u;
+
+    memcpy(frame + frame_size, event->data, event->size);
+    frame_size += event->size;
+
+    if (frame_size < 3u) {
+        printf("      %u byte(s)\n", (unsigned) event->arg);
+        return;
+    }
+
+    size = modbus_rtu_response_size(frame);
+
+    if (size == 0u) {
+        printf("      not a response frame\n");
+        frame_size = 0u;
+        return;
+    }
+
+    if (frame_size < size) {
+        printf("      slave %u, function %u, %u more byte(s) to come\n", (unsigned) frame[0],
+               (unsigned) frame[1], (unsigned) (size - frame_size));
+        return;
+    }
+
+    if ((frame[1] & MODBUS_EXCEPTION_FLAG) != 0u)
+        printf("      slave %u, exception %u (%s)", (unsigned) frame[0], (unsigned) frame[2],
+               lookup(exception_names, sizeof(exception_names) / sizeof(exception_names[0]),
+                      frame[2]));
+    else
+        printf("      slave %u, function %u, %u data bytes", (unsigned) frame[0],
+               (unsigned) frame[1], (unsigned) frame[2]);
+
+    printf(modbus_crc16_check(frame, size) ? ", CRC ok\n" : ", BAD CRC\n");
+    frame_size = 0u;
+}
+
+static void print_event(const FlightEvent *event, const FlightEvent *previous,
+                        const FlightDumpHeader *header)
+{
+    double delta = 0.0;
+    time_t seconds = 0;
+    uint64_t realtime = 0u;
+    char clock[32];
+
+    /*
+     * Wall clock reconstructed from the pair of clock reads in the header.
+     */
+    realtime = header->realtime - (header->monotonic - event->timestamp);
+    seconds = (time_t) (realtime / 1000000000u);
+    strftime(clock, sizeof(clock), "%H:%M:%S", localtime(&seconds));
+
+    if (previous != NULL)
+        delta = (double) (event->timestamp - previous->timestamp) / 1000.0;
+
+    printf("%s.%06lu %+11.1fus  ", clock, (unsigned long) (realtime % 1000000000u / 1000u),
+           delta);
+
+    switch (event->kind) {
+    case FLIGHT_EVENT_TX:
+        frame_size = 0u;
+        printf("TX     bus %u:", (unsigned) event->source);
+        print_bytes(event);
+        annotate_tx(event);
+        break;
+
+    case FLIGHT_EVENT_RX:
+        printf("RX     bus %u:", (unsigned) event->source);
+        print_bytes(event);
+        annotate_rx(event);
+        break;
+
+    case FLIGHT_EVENT_POLL:
+        printf("POLL   slave %u, registers 0x%08x\n", (unsigned) event->source,
+               (unsigned) event->arg);
+        break;
+
+    case FLIGHT_EVENT_STATE:
+        printf("STATE  slave %u, %s\n", (unsigned) event->source,
+               flight_state_name(event->arg));
+        break;
+
+    case FLIGHT_EVENT_TIMEOUT:
+        printf("TMOUT  bus %u, after %u byte(s)", (unsigned) event->source,
+               (unsigned) event->arg);
+        print_bytes(event);
+        break;
+
+    case FLIGHT_EVENT_ERROR:
+        printf("ERROR  slave %u, %s", (unsigned) event->source,
+               lookup(error_names, sizeof(error_names) / sizeof(error_names[0]), event->arg));
+
+        if (event->size != 0u && event->data[0] != 0u)
+            printf(" %u (%s)", (unsigned) event->data[0],
+                   lookup(exception_names, sizeof(exception_names) / sizeof(exception_names[0]),
+                          event->data[0]));
+
+        printf("\n");
+        break;
+
+    default:
+        printf("?      kind %u\n", (unsigned) event->kind);
+    }
+}
+
+int main(int argc, char **argv)
+{
+    uint32_t i = 0u;
+    FILE *file = NULL;
+    FlightDumpHeader header;
+    FlightEvent events[2];
+
+    if (argc != 2) {
+        fprintf(stderr, "Usage: %s <flight dump>\n", argv[0]);
+        exit(EXIT_FAILURE);
+    }
+
+    file = fopen(argv[1], "rb");
+    if (file == NULL) {
+        perror(argv[1]);
+        exit(EXIT_FAILURE);
+    }
+
+    if (fread(&header, sizeof(header), 1, file) != 1
+        || memcmp(header.magic, FLIGHT_DUMP_MAGIC, sizeof(FLIGHT_DUMP_MAGIC)) != 0
+        || header.event_size != sizeof(FlightEvent)) {
+        fprintf(stderr, "%s: not a flight recorder dump.\n", argv[1]);
+        exit(EXIT_FAILURE);
+    }
+
+    printf("%u events, %lu older ones overwritten\n\n", (unsigned) header.count,
+           (unsigned long) header.dropped);
+
+    for (; i < header.count; ++i) {
+        if (fread(&events[i % 2u], sizeof(FlightEvent), 1, file) != 1) {
+            fprintf(stderr, "%s: truncated after %u events.\n", argv[1], (unsigned) i);
+            break;
+        }
+
+        print_event(&events[i % 2u], i == 0u ? NULL : &events[(i + 1u) % 2u], &header);
+    }
+
+    fclose(file);
+    return 0;
+}
@@ -0,0 +1,133 @@
+#!/usr/bin/env python3
+"""
+Local stand-in for an Ethernet to RS485 gateway with SDM220 meters behind it.
+
+Serves either Modbus TCP (MBAP) or raw RTU frames over TCP, answers FC 03/04
+reads with a float per register pair (200 + address + register) and can be
+told to answer late, to exercise the transport's timeout handling.
+
+Run:
+    tools/modbus-standin.py --framing mbap --port 15020 &
+    ./sdm220 -i 1000 -a 1,2,3 tcp://127.0.0.1:15020
+
+    tools/modbus-standin.py --framing rtu --port 15021 --late 0.2 &
+    ./sdm220 -i 1000 -a 1,2,3 rtu+tcp://127.0.0.1:15021
+"""
+import argparse
+import random
+import select
+import socket
+import struct
+import threading
+import time
+
+READ_HOLDING_REGISTERS = 3
+READ_INPUT_REGISTERS = 4
+ILLEGAL_FUNCTION = 1
+
+
+def crc16(data):
+    crc = 0xffff
+    for byte in data:
+        crc ^= byte
+        for _ in range(8):
+            crc = (crc >> 1) ^ 0xa001 if crc & 1 else crc >> 1
+    return crc
+
+
+def response_pdu(address, function, start, quantity):
+    if function not in (READ_HOLDING_REGISTERS, READ_INPUT_REGISTERS):
+        return bytes([function | 0x80, ILLEGAL_FUNCTION])
+
+    data = b''.join(struct.pack('>f', 200.0 + address + start + i)
+                    for i in range(0, quantity - quantity % 2, 2))
+    return bytes([function, len(data)]) + data
+
+
+class Connection:
+    def __init__(self, sock, args):
+        self.sock = sock
+        self.args = args
+        self.rx = b''
+        self.pending = []
+
+    def reply_at(self, frame):
+        delay = self.args.delay
+        if random.random() < self.args.late:
+            delay += self.args.late_delay
+        self.pending.append((time.monotonic() + delay, frame))
+
+    def parse_mbap(self):
+        while len(self.rx) >= 7:
+            length = struct.unpack('>H', self.rx[4:6])[0]
+            if len(self.rx) < 6 + length:
+                return
+            frame, self.rx = self.rx[:6 + length], self.rx[6 + length:]
+            unit, function = frame[6], frame[7]
+            start, quantity = struct.unpack('>HH', frame[8:12])
+            if unit not in self.args.addresses:
+                continue
+            pdu = bytes([unit]) + response_pdu(unit, function, start, quantity)
+            self.reply_at(frame[:2] + b'\0\0' + struct.pack('>H', len(pdu)) + pdu)
+
+    def parse_rtu(self):
+        while len(self.rx) >= 8:
+            frame = self.rx[:8]
+            if crc16(frame[:6]) != struct.unpack('<H', frame[6:8])[0]:
+                self.rx = self.rx[1:]
+                continue
+            self.rx = self.rx[8:]
+            address, function = frame[0], frame[1]
+            start, quantity = struct.unpack('>HH', frame[2:6])
+            if address not in self.args.addresses:
+                continue
+            reply = bytes([address]) + response_pdu(address, function, start, quantity)
+            self.reply_at(reply + struct.pack('<H', crc16(reply)))
+
+    def run(self):
+        while True:
+            readable, _, _ = select.select([self.sock], [], [], 0.005)
+            if readable:
+                data = self.sock.recv(4096)
+                if not data:
+                    return
+                self.rx += data
+                if self.args.framing == 'mbap':
+                    self.parse_mbap()
+                else:
+                    self.parse_rtu()
+
+            now = time.monotonic()
+            for due in [p for p in self.pending if p[0] <= now]:
+                self.sock.sendall(due[1])
+                self.pending.remove(due)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__,
+                                     formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument('--framing', choices=('mbap', 'rtu'), default='mbap')
+    parser.add_argument('--port', type=int, default=15020)
+    parser.add_argument('--addresses', default='1,2,3,4,5',
+                        help='comma separated slave addresses that answer')
+    parser.add_argument('--delay', type=float, default=0.05,
+                        help='response time in seconds')
+    parser.add_argument('--late', type=float, default=0.0,
+                        help='fraction of responses sent late')
+    parser.add_argument('--late-delay', type=float, default=3.5,
+                        help='extra delay of a late response in seconds')
+    args = parser.parse_args()
+    args.addresses = {int(a) for a in args.addresses.split(',')}
+
+    server = socket.socket()
+    server.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
+    server.bind(('127.0.0.1', args.port))
+    server.listen(5)
+
+    while True:
+        sock, _ = server.accept()
+        threading.Thread(target=Connection(sock, args).run, daemon=True).start()
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,143 @@
+/*
+ * Scaling of the worker pool from 1 to N workers: one producer thread (in
+ * place of the polling thread) submits report jobs for a fleet of meters,
+ * the workers format them the way print_report does.
+ *
+ * Build: cc -O2 -I. -o worker-pool-bench tools/worker-pool-bench.c worker-pool.c timer.c -lpthread
+ * Run:   ./worker-pool-bench [<max workers> [<jobs>]]
+ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <sched.h>
+#include <unistd.h>
+
+#include "timer.h"
+#include "sdm220.h"
+#include "worker-pool.h"
+
+#define DEFAULT_JOBS        200000
+#define N_METERS            247
+#define REPORT_TEXT_SIZE    1024
+
+typedef struct {
+    uint8_t address;
+    Sdm220RegisterMask changed;
+    double values[SDM220_VALUE_TABLE_SIZE];
+} Report;
+
+static WorkerPool pool;
+static atomic_ulong formatted_bytes;
+
+static void format_report(void *payload, void *user_data)
+{
+    int reg = 0;
+    size_t size = 0u;
+    char text[REPORT_TEXT_SIZE];
+    Report *report = payload;
+
+    (void) user_data;
+
+    size += (size_t) snprintf(text + size, sizeof(text) - size,
+                              "\nSDM220 Data (address %u):\n\n", (unsigned) report->address);
+
+    for (; reg < SDM220_N_REGISTERS; ++reg) {
+        if ((report->changed & SDM220_REGISTER_MASK(reg)) != 0u)
+            size += (size_t) snprintf(text + size, sizeof(text) - size, "Register %-31d %.2f\n",
+                                      reg, report->values[reg]);
+    }
+
+    atomic_fetch_add_explicit(&formatted_bytes, size, memory_order_relaxed);
+}
+
+/*
+ * Jobs per second through n workers. The producer backs off instead of
+ * overrunning the queues, the time measured is the time to get every job
+ * done (or dropped, should one ever be).
+ */
+static double run(size_t n_workers, unsigned long n_jobs, bool ordered)
+{
+    unsigned long i = 0u;
+    long elapsed = 0;
+    size_t backlog = n_workers * WORKER_POOL_QUEUE_SIZE / 2u;
+    Report report;
+    Timer timer;
+
+    if (!worker_pool_init(&pool, n_workers, true)) {
+        fprintf(stderr, "Unable to start %zu workers.\n", n_workers);
+        exit(EXIT_FAILURE);
+    }
+
+    report.changed = SDM220_REGISTER_MASK_ALL;
+
+    timer_start(&timer);
+
+    for (; i < n_jobs; ++i) {
+        report.address = (uint8_t) (i % N_METERS + 1u);
+        report.values[SDM220_REGISTER_ACTIVE_POWER] = (double) i;
+
+        while (atomic_load(&pool.submitted) - atomic_load(&pool.completed)
+               - atomic_load(&pool.dropped) >= backlog)
+            sched_yield();
+
+        if (ordered)
+            worker_pool_submit_ordered(&pool, report.address, format_report, &report,
+                                       sizeof(report), NULL);
+        else
+            worker_pool_submit(&pool, format_report, &report, sizeof(report), NULL);
+    }
+
+    while (atomic_load(&pool.completed) + atomic_load(&pool.dropped)
+           != atomic_load(&pool.submitted))
+        sched_yield();
+
+    elapsed = timer_elapsed_us(&timer);
+
+    worker_pool_destroy(&pool);
+
+    return (double) n_jobs * 1000000.0 / (double) (elapsed > 0 ? elapsed : 1);
+}
+
+int main(int argc, char **argv)
+{
+    size_t n = 0u;
+    size_t max_workers = (size_t) sysconf(_SC_NPROCESSORS_ONLN);
+    unsigned long n_jobs = DEFAULT_JOBS;
+    double ordered_base = 0.0;
+    double any_base = 0.0;
+    double ordered = 0.0;
+    double any = 0.0;
+
+    if (argc > 1)
+        max_workers = strtoul(argv[1], NULL, 0);
+
+    if (argc > 2)
+        n_jobs = strtoul(argv[2], NULL, 0);
+
+    if (max_workers == 0u || max_workers > WORKER_POOL_MAX_WORKERS || n_jobs == 0u) {
+        fprintf(stderr, "Usage: %s [<max workers> [<jobs>]]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    printf("%lu report jobs for %d meters, %ld CPUs online\n\n", n_jobs, N_METERS,
+           sysconf(_SC_NPROCESSORS_ONLN));
+    printf("workers   ordered jobs/s  speedup   any order jobs/s  speedup   stolen  dropped\n");
+
+    /*
+     * Stolen and dropped are those of the any order run.
+     */
+    for (n = 1u; n <= max_workers; ++n) {
+        ordered = run(n, n_jobs, true);
+        any = run(n, n_jobs, false);
+
+        if (n == 1u) {
+            ordered_base = ordered;
+            any_base = any;
+        }
+
+        printf("%7zu %16.0f %8.2f %18.0f %8.2f %8lu %8lu\n", n, ordered, ordered / ordered_base,
+               any, any / any_base, (unsigned long) pool.stolen, (unsigned long) pool.dropped);
+    }
+
+    return 0;
+}
@@ -0,0 +1,148 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "topology.h"
+
+#define TOPOLOGY_MAGIC "# sdm220 topology 1"
+
+/*
+ * One entry per line:
+ *
+ *   <port> <address> <baud rate> <latency ms> <timeout ms> <last seen ms>
+ */
+#define TOPOLOGY_SCAN_FORMAT  "%127s %u %u %lu %lu %lu"
+#define TOPOLOGY_PRINT_FORMAT "%s %u %u %lu %lu %lu\n"
+
+void topology_init(Topology *self, mseconds_t max_age)
+{
+    self->size = 0u;
+    self->max_age = max_age;
+    self->dirty = false;
+}
+
+bool topology_load(Topology *self, const char *path)
+{
+    FILE *file = NULL;
+    char line[256];
+    unsigned address = 0u;
+    TopologyEntry entry;
+
+    file = fopen(path, "r");
+    if (file == NULL)
+        return false;
+
+    if (fgets(line, sizeof(line), file) == NULL
+        || strncmp(line, TOPOLOGY_MAGIC, strlen(TOPOLOGY_MAGIC)) != 0) {
+        fprintf(stderr, "Ignoring topology cache %s: unknown format.\n", path);
+        fclose(file);
+        return false;
+    }
+
+    self->size = 0u;
+
+    while (fgets(line, sizeof(line), file) != NULL && self->size < TOPOLOGY_MAX_ENTRIES) {
+        memset(&entry, 0, sizeof(entry));
+
+        if (sscanf(line, TOPOLOGY_SCAN_FORMAT, entry.port, &address, &entry.baud_rate,
+                   &entry.latency, &entry.timeout, &entry.seen) != 6)
+            continue;
+
+        if (address < 1u || address > 247u)
+            continue;
+
+        entry.address = (uint8_t) address;
+        self->entries[self->size++] = entry;
+    }
+
+    fclose(file);
+
+    self->dirty = false;
+    return true;
+}
+
+bool topology_save(Topology *self, const char *path)
+{
+    size_t i = 0u;
+    FILE *file = NULL;
+    TopologyEntry *entry = NULL;
+    char tmp_path[4096];
+
+    /*
+     * Written aside and renamed over, a crash never leaves half a cache.
+     */
+    if ((size_t) snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path) >= sizeof(tmp_path))
+        return false;
+
+    file = fopen(tmp_path, "w");
+    if (file == NULL) {
+        perror("fopen");
+        return false;
+    }
+
+    fprintf(file, "%s\n", TOPOLOGY_MAGIC);
+
+    for (; i < self->size; ++i) {
+        entry = &self->entries[i];
+
+        fprintf(file, TOPOLOGY_PRINT_FORMAT, entry->port, (unsigned) entry->address,
+                entry->baud_rate, entry->latency, entry->timeout, entry->seen);
+    }
+
+    if (fclose(file) != 0 || rename(tmp_path, path) != 0) {
+        perror("topology_save");
+        remove(tmp_path);
+        return false;
+    }
+
+    self->dirty = false;
+    return true;
+}
+
+TopologyEntry *topology_find(Topology *self, const char *port, uint8_t address)
+{
+    size_t i = 0u;
+
+    for (; i < self->size; ++i) {
+        if (self->entries[i].address == address && strcmp(self->entries[i].port, port) == 0)
+            return &self->entries[i];
+    }
+
+    return NULL;
+}
+
+TopologyEntry *topology_update(Topology *self, const char *port, uint8_t address,
+                               unsigned baud_rate, mseconds_t latency, mseconds_t timeout,
+                               mseconds_t seen)
+{
+    TopologyEntry *entry = NULL;
+
+    if (strlen(port) >= TOPOLOGY_PORT_SIZE || strpbrk(port, " \t\n") != NULL)
+        return NULL;
+
+    entry = topology_find(self, port, address);
+    if (entry == NULL) {
+        if (self->size == TOPOLOGY_MAX_ENTRIES)
+            return NULL;
+
+        entry = &self->entries[self->size++];
+        strcpy(entry->port, port);
+        entry->address = address;
+    }
+
+    entry->baud_rate = baud_rate;
+    entry->latency = latency;
+    entry->timeout = timeout;
+    entry->seen = seen;
+
+    self->dirty = true;
+    return entry;
+}
+
+bool topology_entry_stale(Topology *self, TopologyEntry *entry, mseconds_t now)
+{
+    if (self->max_age == 0u)
+        return false;
+
+    return now < entry->seen || now - entry->seen > self->max_age;
+}
@@ -0,0 +1,73 @@
+/**
+ * @file topology.h
+ * @author Sereda Anton <sereda-anton@yandex.ru>
+ *
+ * Copyright (c) 2017 Sereda Anton
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+#ifndef TOPOLOGY_H
+#define TOPOLOGY_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "timer.h"
+
+#define TOPOLOGY_MAX_ENTRIES    1024
+#define TOPOLOGY_PORT_SIZE      128
+
+typedef struct _Topology Topology;
+typedef struct _TopologyEntry TopologyEntry;
+
+/*
+ * What was learned about one slave: where it answers, at what line speed,
+ * how fast it turns a request around and the timeout tuned from that.
+ * 'seen' is the wall-clock time (timer_timestamp()) of the last answer.
+ */
+struct _TopologyEntry {
+    char port[TOPOLOGY_PORT_SIZE];
+    uint8_t address;
+    unsigned baud_rate;
+    mseconds_t latency;
+    mseconds_t timeout;
+    mseconds_t seen;
+};
+
+struct _Topology {
+    TopologyEntry entries[TOPOLOGY_MAX_ENTRIES];
+    size_t size;
+    mseconds_t max_age;
+    bool dirty;
+};
+
+void topology_init(Topology *self, mseconds_t max_age);
+bool topology_load(Topology *self, const char *path);
+bool topology_save(Topology *self, const char *path);
+
+TopologyEntry *topology_find(Topology *self, const char *port, uint8_t address);
+TopologyEntry *topology_update(Topology *self, const char *port, uint8_t address,
+                               unsigned baud_rate, mseconds_t latency, mseconds_t timeout,
+                               mseconds_t seen);
+bool topology_entry_stale(Topology *self, TopologyEntry *entry, mseconds_t now);
+
+#endif /* TOPOLOGY_H */
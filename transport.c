@@ -0,0 +1,33 @@
+#include "transport.h"
+#include "flight-recorder.h"
+
+bool transport_poll(Transport *self)
+{
+    return self->poll(self);
+}
+
+bool transport_read_byte(Transport *self, uint8_t *byte)
+{
+    return self->read_byte(self, byte);
+}
+
+void transport_write(Transport *self, uint8_t *buf, size_t buf_size)
+{
+    flight_recorder_record(FLIGHT_EVENT_TX, self->bus, (uint32_t) buf_size, buf, buf_size);
+    self->write(self, buf, buf_size);
+}
+
+bool transport_wait(Transport *self, int timeout)
+{
+    if (self->wait == NULL)
+        return self->poll(self);
+
+    return self->wait(self, timeout);
+}
+
+uint16_t transport_next_bus(void)
+{
+    static uint16_t next_bus = 0u;
+
+    return ++next_bus;
+}
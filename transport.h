@@ -0,0 +1,68 @@
+/**
+ * @file transport.h
+ * @author Sereda Anton <sereda-anton@yandex.ru>
+ *
+ * Copyright (c) 2017 Sereda Anton
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+#ifndef TRANSPORT_H
+#define TRANSPORT_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+typedef struct _Transport Transport;
+
+typedef bool (*TransportPollFunc)(Transport *);
+typedef bool (*TransportReadByteFunc)(Transport *, uint8_t *);
+typedef void (*TransportWriteFunc)(Transport *, uint8_t *, size_t);
+typedef bool (*TransportWaitFunc)(Transport *, int);
+
+/*
+ * Byte channel to a Modbus RTU slave: requests are written and responses
+ * read back as plain RTU frames whatever the medium is. Embedded as the
+ * first member of the concrete port structure.
+ *
+ * 'concurrent' is set when several transactions may be in flight on the
+ * transport at once (the medium keeps them apart), otherwise callers must
+ * run one transaction at a time.
+ *
+ * 'bus' numbers the serial port or gateway the transport runs over, from 1
+ * in the order they were opened. Bus events in the flight recorder carry it.
+ */
+struct _Transport {
+    TransportPollFunc poll;
+    TransportReadByteFunc read_byte;
+    TransportWriteFunc write;
+    TransportWaitFunc wait;
+    bool concurrent;
+    uint16_t bus;
+};
+
+bool transport_poll(Transport *self);
+bool transport_read_byte(Transport *self, uint8_t *byte);
+void transport_write(Transport *self, uint8_t *buf, size_t buf_size);
+bool transport_wait(Transport *self, int timeout);
+uint16_t transport_next_bus(void);
+
+#endif /* TRANSPORT_H */
@@ -0,0 +1,274 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <sched.h>
+#include <unistd.h>
+
+#include "worker-pool.h"
+
+static __thread WorkerPool *current_pool = NULL;
+static __thread int current_worker = -1;
+static __thread size_t submit_cursor = 0u;
+
+static void pin_thread(pthread_t thread, int cpu)
+{
+    cpu_set_t set;
+
+    if (cpu < 0)
+        return;
+
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+
+    if (pthread_setaffinity_np(thread, sizeof(set), &set) != 0)
+        fprintf(stderr, "Unable to pin thread to CPU %d.\n", cpu);
+}
+
+static bool queue_init(WorkerQueue *queue, WorkerPool *pool, size_t index)
+{
+    queue->pool = pool;
+    queue->index = index;
+    queue->head = 0u;
+    queue->tail = 0u;
+
+    if (sem_init(&queue->signal, 0, 0u) != 0)
+        return false;
+
+    pthread_mutex_init(&queue->lock, NULL);
+    return true;
+}
+
+static void queue_destroy(WorkerQueue *queue)
+{
+    pthread_mutex_destroy(&queue->lock);
+    sem_destroy(&queue->signal);
+}
+
+static bool queue_push(WorkerQueue *queue, WorkerJob *job, bool may_block)
+{
+    if (may_block)
+        pthread_mutex_lock(&queue->lock);
+    else if (pthread_mutex_trylock(&queue->lock) != 0)
+        return false;
+
+    if (queue->tail - queue->head == WORKER_POOL_QUEUE_SIZE) {
+        pthread_mutex_unlock(&queue->lock);
+        return false;
+    }
+
+    queue->jobs[queue->tail % WORKER_POOL_QUEUE_SIZE] = *job;
+    queue->tail++;
+
+    pthread_mutex_unlock(&queue->lock);
+    sem_post(&queue->signal);
+    return true;
+}
+
+/*
+ * Owner and thieves both take the oldest job: samples are independent, so
+ * latency matters more than the cache locality LIFO would buy. Thieves
+ * leave ordered jobs alone, the owner runs them in turn.
+ */
+static bool queue_pop(WorkerQueue *queue, WorkerJob *job, bool stealing)
+{
+    pthread_mutex_lock(&queue->lock);
+
+    if (queue->head == queue->tail
+        || (stealing && queue->jobs[queue->head % WORKER_POOL_QUEUE_SIZE].ordered)) {
+        pthread_mutex_unlock(&queue->lock);
+        return false;
+    }
+
+    *job = queue->jobs[queue->head % WORKER_POOL_QUEUE_SIZE];
+    queue->head++;
+
+    pthread_mutex_unlock(&queue->lock);
+    return true;
+}
+
+static bool steal(WorkerPool *self, size_t index, WorkerJob *job)
+{
+    size_t i = 1u;
+
+    for (; i < self->n_workers; ++i) {
+        if (queue_pop(&self->queues[(index + i) % self->n_workers], job, true)) {
+            atomic_fetch_add_explicit(&self->stolen, 1u, memory_order_relaxed);
+            return true;
+        }
+    }
+
+    return false;
+}
+
+static void *worker_main(void *arg)
+{
+    WorkerJob job;
+    WorkerQueue *queue = arg;
+    WorkerPool *self = queue->pool;
+    size_t index = queue->index;
+
+    current_pool = self;
+    current_worker = (int) index;
+
+    for (;;) {
+        if (queue_pop(&self->queues[index], &job, false) || steal(self, index, &job)) {
+            job.func(job.payload, job.user_data);
+            atomic_fetch_add_explicit(&self->completed, 1u, memory_order_relaxed);
+            continue;
+        }
+
+        if (!worker_pool_running(self))
+            break;
+
+        /*
+         * Each queued job posts its queue once, the owner wakes for it even
+         * if a thief got there first.
+         */
+        while (sem_wait(&self->queues[index].signal) != 0 && errno == EINTR) {}
+    }
+
+    return NULL;
+}
+
+bool worker_pool_init(WorkerPool *self, size_t n_workers, bool pin_workers)
+{
+    size_t i = 0u;
+    long n_cpus = 0;
+
+    if (n_workers == 0u || n_workers > WORKER_POOL_MAX_WORKERS)
+        return false;
+
+    self->n_workers = 0u;
+
+    atomic_init(&self->running, true);
+    atomic_init(&self->submitted, 0u);
+    atomic_init(&self->completed, 0u);
+    atomic_init(&self->stolen, 0u);
+    atomic_init(&self->dropped, 0u);
+
+    for (i = 0u; i < n_workers; ++i) {
+        if (!queue_init(&self->queues[i], self, i)) {
+            while (i-- > 0u)
+                queue_destroy(&self->queues[i]);
+
+            return false;
+        }
+    }
+
+    n_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+    for (i = 0u; i < n_workers; ++i) {
+        if (pthread_create(&self->workers[i], NULL, worker_main, &self->queues[i]) != 0) {
+            worker_pool_destroy(self);
+            return false;
+        }
+
+        self->n_workers++;
+
+        if (pin_workers && n_cpus > 0)
+            pin_thread(self->workers[i], (int) (i % (size_t) n_cpus));
+    }
+
+    return true;
+}
+
+void worker_pool_destroy(WorkerPool *self)
+{
+    size_t i = 0u;
+
+    atomic_store(&self->running, false);
+
+    /*
+     * Workers drain whatever is still queued before they leave.
+     */
+    for (i = 0u; i < self->n_workers; ++i)
+        sem_post(&self->queues[i].signal);
+
+    for (i = 0u; i < self->n_workers; ++i)
+        pthread_join(self->workers[i], NULL);
+
+    for (i = 0u; i < self->n_workers; ++i)
+        queue_destroy(&self->queues[i]);
+
+    self->n_workers = 0u;
+}
+
+bool worker_pool_running(WorkerPool *self)
+{
+    return atomic_load_explicit(&self->running, memory_order_relaxed);
+}
+
+static void job_init(WorkerJob *job, WorkerJobFunc func, const void *payload,
+                     size_t payload_size, void *user_data, bool ordered)
+{
+    job->func = func;
+    job->user_data = user_data;
+    job->ordered = ordered;
+
+    if (payload_size != 0u)
+        memcpy(job->payload, payload, payload_size);
+}
+
+bool worker_pool_submit(WorkerPool *self, WorkerJobFunc func, const void *payload,
+                        size_t payload_size, void *user_data)
+{
+    size_t i = 0u;
+    size_t index = 0u;
+    bool is_worker = false;
+    WorkerJob job;
+
+    if (payload_size > WORKER_JOB_PAYLOAD_SIZE || func == NULL)
+        return false;
+
+    job_init(&job, func, payload, payload_size, user_data, false);
+    atomic_fetch_add_explicit(&self->submitted, 1u, memory_order_relaxed);
+
+    /*
+     * Work spawned by a job stays on its worker (others will steal it if
+     * they run dry). Anybody else spreads jobs round robin, first only
+     * try-locking and moving on to the next queue on contention. Should
+     * every queue have been busy, they are gone through again waiting for
+     * the lock (held for a job copy at most), so a job is only dropped
+     * when all queues are full.
+     */
+    is_worker = current_pool == self && current_worker >= 0;
+    index = is_worker ? (size_t) current_worker : submit_cursor++ % self->n_workers;
+
+    for (; i < self->n_workers; ++i) {
+        if (queue_push(&self->queues[(index + i) % self->n_workers], &job, is_worker && i == 0u))
+            return true;
+    }
+
+    for (i = 0u; i < self->n_workers; ++i) {
+        if (queue_push(&self->queues[(index + i) % self->n_workers], &job, true))
+            return true;
+    }
+
+    atomic_fetch_add_explicit(&self->dropped, 1u, memory_order_relaxed);
+    return false;
+}
+
+/*
+ * Ordered jobs have only the one queue to go to. Queue locks are held for a
+ * job copy at most, never while a job runs, so this waits for the lock
+ * instead of dropping the job on contention.
+ */
+bool worker_pool_submit_ordered(WorkerPool *self, size_t key, WorkerJobFunc func,
+                                const void *payload, size_t payload_size, void *user_data)
+{
+    WorkerJob job;
+
+    if (payload_size > WORKER_JOB_PAYLOAD_SIZE || func == NULL)
+        return false;
+
+    job_init(&job, func, payload, payload_size, user_data, true);
+    atomic_fetch_add_explicit(&self->submitted, 1u, memory_order_relaxed);
+
+    if (queue_push(&self->queues[key % self->n_workers], &job, true))
+        return true;
+
+    atomic_fetch_add_explicit(&self->dropped, 1u, memory_order_relaxed);
+    return false;
+}
@@ -0,0 +1,103 @@
+/**
+ * @file worker-pool.h
+ * @author Sereda Anton <sereda-anton@yandex.ru>
+ *
+ * Copyright (c) 2017 Sereda Anton
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+#ifndef WORKER_POOL_H
+#define WORKER_POOL_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <semaphore.h>
+
+#define WORKER_POOL_MAX_WORKERS     64
+#define WORKER_POOL_QUEUE_SIZE      1024
+#define WORKER_JOB_PAYLOAD_SIZE     192
+
+typedef struct _WorkerPool WorkerPool;
+typedef struct _WorkerJob WorkerJob;
+typedef struct _WorkerQueue WorkerQueue;
+
+typedef void (*WorkerJobFunc)(void *payload, void *user_data);
+
+/*
+ * A job carries its input by value, so the producer does not have to keep
+ * anything alive and nothing is allocated per job. Ordered jobs stay on the
+ * queue they were submitted to.
+ */
+struct _WorkerJob {
+    WorkerJobFunc func;
+    void *user_data;
+    bool ordered;
+    uint8_t payload[WORKER_JOB_PAYLOAD_SIZE] __attribute__((aligned (8)));
+};
+
+struct _WorkerQueue {
+    WorkerPool *pool;
+    size_t index;
+    pthread_mutex_t lock;
+    sem_t signal;
+    size_t head;
+    size_t tail;
+    WorkerJob jobs[WORKER_POOL_QUEUE_SIZE];
+} __attribute__((aligned (64)));
+
+/*
+ * CPU work handed off by the polling thread (formatting, output) runs on a
+ * set of workers: each has its own queue, and a worker that runs dry
+ * steals from the others before it goes to sleep. A process owns a single
+ * bus, whose I/O stays serialized on the polling thread.
+ *
+ * The polling thread never waits for a job to run: queue locks are only
+ * held to copy a job in or out. A job is dropped and counted only when
+ * every queue is full.
+ *
+ * NOTE: Jobs from worker_pool_submit() may run in any order and on any
+ * worker. Jobs submitted with worker_pool_submit_ordered() under the same
+ * key run one after the other in submission order, on the key's worker.
+ */
+struct _WorkerPool {
+    WorkerQueue queues[WORKER_POOL_MAX_WORKERS];
+    pthread_t workers[WORKER_POOL_MAX_WORKERS];
+    size_t n_workers;
+    atomic_bool running;
+    atomic_ulong submitted;
+    atomic_ulong completed;
+    atomic_ulong stolen;
+    atomic_ulong dropped;
+};
+
+bool worker_pool_init(WorkerPool *self, size_t n_workers, bool pin_workers);
+void worker_pool_destroy(WorkerPool *self);
+bool worker_pool_running(WorkerPool *self);
+
+bool worker_pool_submit(WorkerPool *self, WorkerJobFunc func, const void *payload,
+                        size_t payload_size, void *user_data);
+bool worker_pool_submit_ordered(WorkerPool *self, size_t key, WorkerJobFunc func,
+                                const void *payload, size_t payload_size, void *user_data);
+
+#endif /* WORKER_POOL_H */